@@ -0,0 +1,1080 @@
+#include "htslib/hts.h"
+#include "htslib/thread_pool.h"
+#include <seqan/bam_io.h>
+#include <iostream>
+#include <seqan/stream.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <cmath>
+#include <cstdlib>
+#include <stdint.h>
+#include <vector>
+#include <seqan/hts_io.h>
+
+#include "bamhash_checksum_common.h"
+#include "bamhash_bam.h"
+#include "bamhash_cache.h"
+#include "bamhash_pipeline.h"
+#include "bamhash_decode.h"
+#include "bamhash_split.h"
+
+// -----------------------------------------------------------------------------
+// FUNCTION getReadGroups()
+// -----------------------------------------------------------------------------
+
+// The IDs of the @RG lines of the header, in order.
+
+void getReadGroups(std::vector<std::string> & readGroups, std::string const & header)
+{
+  readGroups.clear();
+  for (size_t i = 0; i < header.size(); /*empty on purpose*/)
+  {
+    auto hdr_find_it = std::find(header.begin() + i, header.end(), '\n');
+    std::string line = header.substr(i, hdr_find_it - header.begin() - i);
+
+    if (line.size() > 7 && line[0] == '@' && line[1] == 'R' && line[2] == 'G' && line[3] == '\t')
+    {
+      for (int j = 0; j < static_cast<int>(line.size()); /*empty on purpose*/)
+      {
+        auto line_find_it = std::find(line.begin() + j, line.end(), '\t');
+        std::string field = line.substr(j, line_find_it - line.begin() - j);
+
+        if (field.size() > 3 && field[0] == 'I' && field[1] == 'D' && field[2] == ':')
+        {
+          readGroups.push_back(field.substr(3));
+        }
+
+        j = std::distance(line.begin(), line_find_it) + 1;
+      }
+    }
+
+    i = std::distance(header.begin(), hdr_find_it) + 1;
+  }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION getLaneNames()
+// -----------------------------------------------------------------------------
+
+// Numbers the read groups as they come, a read group that is already known
+// gets a new lane.
+
+void addLaneNames(std::map<seqan::CharString, unsigned> & laneNames, std::vector<std::string> const & readGroups)
+{
+  for (size_t i = 0; i < readGroups.size(); ++i)
+  {
+    int read_group_index = laneNames.size();
+    laneNames[seqan::CharString(readGroups[i])] = read_group_index;
+  }
+}
+
+void getLaneNames(std::map<seqan::CharString, unsigned> & laneNames, std::string const & header)
+{
+  std::vector<std::string> readGroups;
+  getReadGroups(readGroups, header);
+  addLaneNames(laneNames, readGroups);
+}
+
+// -----------------------------------------------------------------------------
+// CLASS LaneTable
+// -----------------------------------------------------------------------------
+
+// Maps read group IDs to their lanes without allocating: an open addressing
+// hash table over the entries of laneNames, rebuilt whenever laneNames changes.
+
+class LaneTable
+{
+  public:
+  void build(std::map<seqan::CharString, unsigned> const & laneNames);
+
+  // The lane of the read group, -1 if it is not in the table.
+  int find(const char * name, size_t length) const;
+
+  private:
+  static uint64_t hashName(const char * name, size_t length);
+
+  std::vector<std::string> names;
+  std::vector<int> lanes;
+  std::vector<int> slots; // index into names, -1 for an empty slot
+};
+
+uint64_t LaneTable::hashName(const char * name, size_t length)
+{
+  // FNV-1a
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < length; ++i)
+  {
+    h ^= (unsigned char)name[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+void LaneTable::build(std::map<seqan::CharString, unsigned> const & laneNames)
+{
+  names.clear();
+  lanes.clear();
+  for (std::map<seqan::CharString, unsigned>::const_iterator it = laneNames.begin(); it != laneNames.end(); ++it)
+  {
+    names.push_back(std::string(toCString(it->first), length(it->first)));
+    lanes.push_back(it->second);
+  }
+
+  // at most half full, so lookups rarely probe more than one slot
+  size_t size = 16;
+  while (size < 2 * names.size())
+    size *= 2;
+  slots.assign(size, -1);
+
+  for (size_t i = 0; i < names.size(); ++i)
+  {
+    size_t slot = hashName(names[i].data(), names[i].size()) & (size - 1);
+    while (slots[slot] != -1)
+      slot = (slot + 1) & (size - 1);
+    slots[slot] = i;
+  }
+}
+
+int LaneTable::find(const char * name, size_t length) const
+{
+  size_t mask = slots.size() - 1;
+  for (size_t slot = hashName(name, length) & mask; slots[slot] != -1; slot = (slot + 1) & mask)
+  {
+    std::string const & candidate = names[slots[slot]];
+    if (candidate.size() == length && memcmp(candidate.data(), name, length) == 0)
+      return lanes[slots[slot]];
+  }
+  return -1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION findAux()
+// -----------------------------------------------------------------------------
+
+// The type byte of the first aux field with the given tag, as bam_aux_get(),
+// or NULL if there is none or the aux data is broken before it.
+
+uint8_t const * findAux(bam1_t const * record, char const tag[2])
+{
+  uint8_t const * p = bam_get_aux(record);
+  uint8_t const * end = record->data + record->l_data;
+
+  while (end - p >= 3)
+  {
+    if (p[0] == tag[0] && p[1] == tag[1])
+      return p + 2;
+
+    uint8_t type = p[2];
+    p += 3;
+    switch (type)
+    {
+      case 'A': case 'c': case 'C':
+        p += 1;
+        break;
+      case 's': case 'S':
+        p += 2;
+        break;
+      case 'i': case 'I': case 'f':
+        p += 4;
+        break;
+      case 'd':
+        p += 8;
+        break;
+      case 'Z': case 'H':
+        p = (uint8_t const *)memchr(p, 0, end - p);
+        if (p == NULL)
+          return NULL;
+        p += 1;
+        break;
+      case 'B':
+      {
+        if (end - p < 5)
+          return NULL;
+        uint32_t count;
+        memcpy(&count, p + 1, 4);
+        int size = (p[0] == 'c' || p[0] == 'C') ? 1 : (p[0] == 's' || p[0] == 'S') ? 2 :
+                   (p[0] == 'i' || p[0] == 'I' || p[0] == 'f') ? 4 : 0;
+        if (size == 0 || (uint64_t)count * size > (uint64_t)(end - p - 5))
+          return NULL;
+        p += 5 + (size_t)count * size;
+        break;
+      }
+      default:
+        return NULL;
+    }
+  }
+  return NULL;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION getLane()
+// -----------------------------------------------------------------------------
+
+// A read group that is not in laneNames is added to it, in lane 0, or with
+// ownLanes in a lane of its own. Returns -1 if the record has no read group,
+// after printing it unless quiet.
+
+int getLane(bam1_t * record,
+            std::map<seqan::CharString, unsigned> & laneNames,
+            LaneTable & laneTable, bool ownLanes = false, bool quiet = false)
+{
+  uint8_t const * tag = findAux(record, "RG");
+
+  if (tag == NULL)
+  {
+    if (!quiet)
+      std::cerr << "ERROR: Found a read with a missing read group (RG) tag\n";
+    return -1;
+  }
+
+  char const * read_group = (char const *)tag + 1;
+  char const * read_group_end = NULL;
+  if (*tag == 'Z' || *tag == 'H')
+    read_group_end = (char const *)memchr(read_group, 0, (char const *)(record->data + record->l_data) - read_group);
+
+  if (read_group_end == NULL)
+  {
+    if (!quiet)
+      std::cerr << "ERROR: Failed to extract read group (RG) tag value\n";
+    return -1;
+  }
+
+  int lane = laneTable.find(read_group, read_group_end - read_group);
+  if (lane == -1)
+  {
+    // not in the header: counted in lane 0, or its own, and printed under its own name
+    if (ownLanes)
+    {
+      unsigned next = laneNames.size();
+      laneNames[read_group] = next;
+    }
+    lane = laneNames[read_group];
+    laneTable.build(laneNames);
+  }
+  return lane;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION decodeSeq()
+// -----------------------------------------------------------------------------
+
+// Decodes bases [from, from + n) of the record to out. Reads on the reverse
+// strand are reverse complemented back to their sequenced orientation, see
+// bamhash_decode.h.
+
+// Bases decoded at a time when a read is hashed while it is decoded.
+#define BAMHASH_DECODE_CHUNK 4096
+
+void decodeSeq(char * out, bam1_t * record, int32_t from, int32_t n, bool reverse)
+{
+  int32_t len = record->core.l_qseq;
+  uint8_t const * seq = bam_get_seq(record);
+
+  if (reverse) {
+    decodeBasesReverse(out, seq, len - from, n);
+  } else {
+    decodeBases(out, seq, from, n);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION decodeQual()
+// -----------------------------------------------------------------------------
+
+void decodeQual(char * out, bam1_t * record, int32_t from, int32_t n, bool reverse)
+{
+  int32_t len = record->core.l_qseq;
+  uint8_t const * qual = bam_get_qual(record);
+
+  if (reverse) {
+    decodeQualsReverse(out, qual, len - from, n);
+  } else {
+    decodeQuals(out, qual, from, n);
+  }
+
+  // A missing quality (0xff) of a single base read is hashed as "*"
+  if (len == 1 && n == 1 && out[0] == ' ') {
+    out[0] = '*';
+  }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION appendSeq()
+// -----------------------------------------------------------------------------
+
+// Both append the decoded field of the record, a std::string gets it decoded in
+// place, a HashStream piece by piece.
+
+void appendSeq(std::string & str, bam1_t * record, bool reverse)
+{
+  int32_t len = record->core.l_qseq;
+  size_t pos = str.size();
+  str.resize(pos + len);
+  decodeSeq(&str[pos], record, 0, len, reverse);
+}
+
+void appendSeq(HashStream & stream, bam1_t * record, bool reverse)
+{
+  char buf[BAMHASH_DECODE_CHUNK];
+  int32_t len = record->core.l_qseq;
+  for (int32_t from = 0; from < len; from += BAMHASH_DECODE_CHUNK) {
+    int32_t n = std::min(len - from, BAMHASH_DECODE_CHUNK);
+    decodeSeq(buf, record, from, n, reverse);
+    stream.update(buf, n);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION appendQual()
+// -----------------------------------------------------------------------------
+
+void appendQual(std::string & str, bam1_t * record, bool reverse)
+{
+  int32_t len = record->core.l_qseq;
+  size_t pos = str.size();
+  str.resize(pos + len);
+  decodeQual(&str[pos], record, 0, len, reverse);
+}
+
+void appendQual(HashStream & stream, bam1_t * record, bool reverse)
+{
+  char buf[BAMHASH_DECODE_CHUNK];
+  int32_t len = record->core.l_qseq;
+  for (int32_t from = 0; from < len; from += BAMHASH_DECODE_CHUNK) {
+    int32_t n = std::min(len - from, BAMHASH_DECODE_CHUNK);
+    decodeQual(buf, record, from, n, reverse);
+    stream.update(buf, n);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION appendRead()
+// -----------------------------------------------------------------------------
+
+// Appends the hashed string of the record to a std::string or a HashStream.
+
+template <typename TTarget>
+void appendRead(TTarget & target, bam1_t * record, Baminfo const & info, bool & pairedWarning)
+{
+  uint16_t flag = record->core.flag;
+  // Check if flag: reverse complement and change record accordingly
+  bool reverse = flag & BAM_FREVERSE;
+
+  if (!info.noReadNames) {
+    target.append(bam_get_qname(record));
+    if(flag & BAM_FREAD2) {
+      if (info.paired) {
+        target.append("/2");
+      } else {
+        if (!pairedWarning) {
+          std::cerr << "WARNING: seqread was run with --no-paired mode, but BAM file has reads marked as second pair" << std::endl;
+          pairedWarning = true;
+        }
+        target.append("/1");
+      }
+    } else {
+      target.append("/1");
+    }
+  }
+
+  appendSeq(target, record, reverse);
+  if (!info.noQuality) {
+    appendQual(target, record, reverse);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION hashRecord()
+// -----------------------------------------------------------------------------
+
+// Adds a record to the pipeline, unless it is secondary or supplementary.
+// Returns false if its read group can't be found, see getLane().
+
+bool hashRecord(HashPipeline & pipeline, bam1_t * record, std::map<seqan::CharString, unsigned> & laneNames,
+                LaneTable & laneTable, Baminfo const & info, bool & pairedWarning, bool ownLanes = false,
+                bool quiet = false)
+{
+  int l = getLane(record, laneNames, laneTable, ownLanes, quiet);
+  if (l == -1) return false;
+
+  uint16_t flag = record->core.flag;
+  // Check if flag: supplementary and exclude those
+  if (!(flag & BAM_FSUPPLEMENTARY) && !(flag & BAM_FSECONDARY)) {
+    HashBatch & batch = pipeline.batch();
+    // the mate of the "/1" or "/2" in the hashed string
+    int mate = (flag & BAM_FREAD2) && info.paired ? 2 : 1;
+    // Construct one string from record, very long reads are hashed as they are decoded
+    if (pipeline.streams(record->core.l_qname + 2 * (size_t)record->core.l_qseq)) {
+      HashStream stream(pipeline.hashFunction());
+      appendRead(stream, record, info, pairedWarning);
+      batch.addHash(stream.final(), l, mate);
+    } else {
+      appendRead(batch.add(l, mate), record, info, pairedWarning);
+    }
+
+    // Hand the batch over for hashing once it is full
+    if (batch.full()) {
+      pipeline.submit();
+    }
+  }
+  return true;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION makeShards()
+// -----------------------------------------------------------------------------
+
+// With --shards the input files are read in shards, on several threads. A
+// shard of an indexed file is a range of start positions on one reference,
+// or the reads without a position (tid HTS_IDX_NOCOOR). One of a BAM file
+// without an index is a range of virtual offsets [offset, endOffset), see
+// splitBam(). Other files are one shard.
+
+struct Shard
+{
+  enum Kind
+  {
+    REGION,
+    RANGE,
+    WHOLE_FILE
+  };
+
+  Kind kind;
+  unsigned file;
+  int tid;
+  int32_t beg;
+  int32_t end;
+  int64_t offset;
+  int64_t endOffset;
+};
+
+// Cuts the references into about 4 shards per thread, with about the same
+// number of reads each. The index has the read count of every reference
+// (not for CRAM, there the reference length is used instead); within a
+// reference the reads are taken to be evenly spread.
+
+void makeShards(std::vector<Shard> & shards, unsigned file, bam_hdr_t * hdr, hts_idx_t * idx, unsigned numThreads)
+{
+  std::vector<double> weights(hdr->n_targets);
+  double total = 0;
+  bool haveStats = true;
+  for (int tid = 0; tid < hdr->n_targets; ++tid) {
+    uint64_t mapped = 0, unmapped = 0;
+    if (haveStats && hts_idx_get_stat(idx, tid, &mapped, &unmapped) < 0) {
+      haveStats = false;
+    }
+    weights[tid] = mapped + unmapped;
+  }
+  if (!haveStats) {
+    for (int tid = 0; tid < hdr->n_targets; ++tid) {
+      weights[tid] = hdr->target_len[tid];
+    }
+  }
+  for (int tid = 0; tid < hdr->n_targets; ++tid) {
+    total += weights[tid];
+  }
+
+  double perShard = total / (4.0 * numThreads);
+  for (int tid = 0; tid < hdr->n_targets; ++tid) {
+    if (haveStats && weights[tid] == 0) {
+      continue;
+    }
+    int32_t len = hdr->target_len[tid];
+    int pieces = perShard > 0 ? (int)(weights[tid] / perShard + 0.5) : 1;
+    pieces = std::max(1, std::min(pieces, std::max(len, 1)));
+    for (int p = 0; p < pieces; ++p) {
+      Shard shard = {Shard::REGION, file, tid, 0, 0, -1, -1};
+      shard.beg = p == 0 ? 0 : (int32_t)((int64_t)len * p / pieces);
+      // the last shard takes whatever lies beyond the reference length
+      shard.end = p == pieces - 1 ? INT32_MAX : (int32_t)((int64_t)len * (p + 1) / pieces);
+      shards.push_back(shard);
+    }
+  }
+
+  // the unmapped reads at the end of the file
+  Shard unplaced = {Shard::REGION, file, HTS_IDX_NOCOOR, 0, 0, -1, -1};
+  shards.push_back(unplaced);
+}
+
+// The ranges between the cuts of splitBam(), about 4 per thread. The last one
+// runs to the end of the file.
+
+void makeShards(std::vector<Shard> & shards, unsigned file, std::vector<int64_t> const & offsets)
+{
+  for (size_t i = 0; i < offsets.size(); ++i) {
+    Shard shard = {Shard::RANGE, file, -1, 0, 0, offsets[i], i + 1 < offsets.size() ? offsets[i + 1] : INT64_MAX};
+    shards.push_back(shard);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// CLASS ShardReader
+// -----------------------------------------------------------------------------
+
+// Reads the shards of all input files on several threads. The threads take
+// the shards of the largest file first, see WorkQueue, open the file of a
+// shard themselves and hash every shard on its own HashPipeline, into the
+// sums of its file. Region queries return every read overlapping the region,
+// so a read is only hashed in the shard its start position lies in. A range
+// of virtual offsets has to end exactly where the next one starts, otherwise
+// a cut of splitBam() was not on a record and the sums of that file are
+// dropped. The sums are kept per file, in lanes of their own, and added up
+// by addFileCounts(). As the sum does not depend on the order of the reads,
+// the result is that of reading the files one after another.
+
+class ShardReader
+{
+  public:
+  struct ShardThread
+  {
+    ShardReader * reader;
+    // the sums of every file, so those of a file that is read again can be left out
+    std::vector<std::vector<Counts> > counts;
+    // the read groups of every file that are not in fileLanes
+    std::vector<std::map<seqan::CharString, unsigned> > missingLanes;
+    std::vector<char> aligned;
+    bool pairedWarning;
+    bool ok;
+
+    void operator()();
+  };
+
+  // fileLanes[i] are the lanes of the read groups known when file i is read,
+  // those in its header and the headers before it. Lane 0 is left for read
+  // groups that are missing from them.
+  ShardReader(std::vector<std::string> const & bamfiles, std::vector<std::map<seqan::CharString, unsigned> > const & fileLanes,
+              const char * reference, htsThreadPool * pool, int requiredFields, Baminfo const & info,
+              std::vector<Shard> const & shards);
+
+  // Hashes all shards on numThreads threads and adds the sums of file i to
+  // fileCounts[i], in the lanes of fileLanes[i]. The read groups that are
+  // missing from those are added to missingLanes[i]. Returns false if a thread
+  // failed. The files whose ranges of virtual offsets did not line up are
+  // left out and added to reread, they have to be read from start to end.
+  bool run(unsigned numThreads, std::vector<std::vector<Counts> > & fileCounts,
+           std::vector<std::map<seqan::CharString, unsigned> > & missingLanes, bool & pairedWarning,
+           std::vector<unsigned> & reread);
+
+  private:
+  std::vector<std::string> const & bamfiles;
+  std::vector<std::map<seqan::CharString, unsigned> > const & fileLanes;
+  const char * reference;
+  htsThreadPool * pool;
+  int requiredFields;
+  Baminfo const & info;
+  std::vector<Shard> const & shards;
+  WorkQueue queue;
+};
+
+// The size of the file of every shard, the queue takes the largest file first.
+std::vector<uint64_t> shardSizes(std::vector<std::string> const & bamfiles, std::vector<Shard> const & shards)
+{
+  std::vector<uint64_t> sizes(shards.size());
+  for (size_t i = 0; i < shards.size(); ++i)
+    sizes[i] = fileSize(bamfiles[shards[i].file].c_str());
+  return sizes;
+}
+
+ShardReader::ShardReader(std::vector<std::string> const & bamfiles,
+                         std::vector<std::map<seqan::CharString, unsigned> > const & fileLanes,
+                         const char * reference, htsThreadPool * pool, int requiredFields, Baminfo const & info,
+                         std::vector<Shard> const & shards) :
+  bamfiles(bamfiles), fileLanes(fileLanes), reference(reference), pool(pool), requiredFields(requiredFields),
+  info(info), shards(shards), queue(shardSizes(bamfiles, shards))
+{}
+
+// Adds the lanes that were not in fileLanes to missingLanes.
+void addMissingLanes(std::map<seqan::CharString, unsigned> & missingLanes,
+                     std::map<seqan::CharString, unsigned> const & laneNames,
+                     std::map<seqan::CharString, unsigned> const & fileLanes)
+{
+  for (std::map<seqan::CharString, unsigned>::const_iterator it = laneNames.begin(); it != laneNames.end(); ++it)
+  {
+    if (fileLanes.find(it->first) == fileLanes.end())
+      missingLanes[it->first] = 0;
+  }
+}
+
+void ShardReader::ShardThread::operator()()
+{
+  seqan::HtsFile * inStream = NULL;
+  unsigned file = 0;
+  std::map<seqan::CharString, unsigned> laneNames;
+  LaneTable laneTable;
+
+  unsigned job;
+  while (ok && reader->queue.next(job))
+  {
+    Shard const & shard = reader->shards[job];
+    if (!aligned[shard.file])
+      continue;
+
+    // the shards of a file come one after another
+    if (inStream == NULL || shard.file != file)
+    {
+      if (inStream != NULL)
+      {
+        addMissingLanes(missingLanes[file], laneNames, reader->fileLanes[file]);
+        delete inStream;
+      }
+      file = shard.file;
+      inStream = new seqan::HtsFile(reader->bamfiles[file].c_str(), "r", reader->reference, reader->pool,
+                                    reader->requiredFields);
+      laneNames = reader->fileLanes[file];
+      laneTable.build(laneNames);
+    }
+
+    const char * bamfile = reader->bamfiles[file].c_str();
+    HashPipeline pipeline(0, false, reader->info.hash);
+
+    if (shard.kind == Shard::RANGE)
+    {
+      BGZF * bgzf = inStream->fp->fp.bgzf;
+      if (bgzf_seek(bgzf, shard.offset, SEEK_SET) < 0)
+      {
+        std::cerr << "ERROR: Could not seek in " << bamfile << "\n";
+        ok = false;
+        reader->queue.stop();
+        break;
+      }
+
+      // a range that does not start on a record can give one without a
+      // read group, the file is then read again like any misaligned one
+      while (bgzf_tell(bgzf) < shard.endOffset && seqan::readRecord(*inStream))
+      {
+        if (!hashRecord(pipeline, inStream->hts_record, laneNames, laneTable, reader->info, pairedWarning, false, true))
+        {
+          aligned[file] = false;
+          break;
+        }
+      }
+      if (shard.endOffset != INT64_MAX && bgzf_tell(bgzf) != shard.endOffset)
+        aligned[file] = false;
+    }
+    else if (shard.kind == Shard::REGION)
+    {
+      if (inStream->hts_index == nullptr && !loadIndex(*inStream))
+      {
+        std::cerr << "ERROR: Could not load the index of " << bamfile << "\n";
+        ok = false;
+        reader->queue.stop();
+        break;
+      }
+      if (!setRegion(*inStream, shard.tid, shard.beg, shard.end))
+      {
+        std::cerr << "ERROR: Could not query a region of " << bamfile << "\n";
+        ok = false;
+        reader->queue.stop();
+        break;
+      }
+
+      while (seqan::readRegion(*inStream))
+      {
+        bam1_t * record = inStream->hts_record;
+        if (shard.tid != HTS_IDX_NOCOOR && record->core.pos < shard.beg)
+          continue;
+
+        if (!hashRecord(pipeline, record, laneNames, laneTable, reader->info, pairedWarning))
+        {
+          ok = false;
+          reader->queue.stop();
+          break;
+        }
+      }
+    }
+    else
+    {
+      while (seqan::readRecord(*inStream))
+      {
+        if (!hashRecord(pipeline, inStream->hts_record, laneNames, laneTable, reader->info, pairedWarning))
+        {
+          ok = false;
+          reader->queue.stop();
+          break;
+        }
+      }
+    }
+
+    pipeline.finish(counts[file]);
+  }
+
+  if (inStream != NULL)
+  {
+    addMissingLanes(missingLanes[file], laneNames, reader->fileLanes[file]);
+    delete inStream;
+  }
+}
+
+bool ShardReader::run(unsigned numThreads, std::vector<std::vector<Counts> > & fileCounts,
+                      std::vector<std::map<seqan::CharString, unsigned> > & missingLanes, bool & pairedWarning,
+                      std::vector<unsigned> & reread)
+{
+  std::vector<seqan::Thread<ShardThread> > threads(numThreads);
+  for (unsigned i = 0; i < numThreads; ++i)
+  {
+    ShardThread & worker = threads[i].worker;
+    worker.reader = this;
+    worker.counts.resize(bamfiles.size());
+    worker.missingLanes.resize(bamfiles.size());
+    worker.aligned.assign(bamfiles.size(), true);
+    worker.pairedWarning = pairedWarning;
+    worker.ok = true;
+    seqan::run(threads[i]);
+  }
+
+  bool ok = true;
+  std::vector<char> aligned(bamfiles.size(), true);
+  for (unsigned i = 0; i < numThreads; ++i)
+  {
+    seqan::waitFor(threads[i]);
+    ok = ok && threads[i].worker.ok;
+    for (size_t f = 0; f < bamfiles.size(); ++f)
+      aligned[f] = aligned[f] && threads[i].worker.aligned[f];
+  }
+  if (!ok)
+    return false;
+
+  fileCounts.resize(bamfiles.size());
+  missingLanes.resize(bamfiles.size());
+  for (unsigned i = 0; i < numThreads; ++i)
+  {
+    ShardThread & worker = threads[i].worker;
+    pairedWarning = pairedWarning || worker.pairedWarning;
+
+    for (size_t f = 0; f < bamfiles.size(); ++f)
+    {
+      if (!aligned[f])
+        continue;
+
+      missingLanes[f].insert(worker.missingLanes[f].begin(), worker.missingLanes[f].end());
+      std::vector<Counts> const & counts = worker.counts[f];
+      if (counts.size() > fileCounts[f].size())
+        fileCounts[f].resize(counts.size());
+      for (size_t l = 0; l < counts.size(); ++l)
+        fileCounts[f][l].add(counts[l]);
+    }
+  }
+
+  for (unsigned f = 0; f < bamfiles.size(); ++f)
+  {
+    if (!aligned[f])
+      reread.push_back(f);
+  }
+  return true;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION addFileCounts()
+// -----------------------------------------------------------------------------
+
+// Adds the sums of files read with --shards to counts, in the lanes that reading
+// the files one after another gives them. There getLaneNames() numbers the read
+// groups of every header as it comes, and a read group missing from the headers
+// read so far is put in lane 0 by getLane(). Every file was counted in lanes of
+// its own, fileLanes[i], with lane 0 for its missing read groups, so the lanes
+// of one read group can be looked up now that all files are read.
+
+void addFileCounts(std::vector<Counts> & counts, std::map<seqan::CharString, unsigned> & laneNames,
+                   std::vector<std::string> const & headers,
+                   std::vector<std::map<seqan::CharString, unsigned> > const & fileLanes,
+                   std::vector<std::vector<Counts> > const & fileCounts,
+                   std::vector<std::map<seqan::CharString, unsigned> > const & missingLanes)
+{
+  for (size_t f = 0; f < headers.size(); ++f)
+  {
+    getLaneNames(laneNames, headers[f]);
+
+    std::vector<unsigned> lanes(fileCounts[f].size(), 0);
+    for (std::map<seqan::CharString, unsigned>::const_iterator it = fileLanes[f].begin(); it != fileLanes[f].end(); ++it)
+    {
+      // a read group that was missing from an earlier file is known by now
+      std::map<seqan::CharString, unsigned>::iterator lane = laneNames.find(it->first);
+      if (it->second < lanes.size() && lane != laneNames.end())
+        lanes[it->second] = lane->second;
+    }
+
+    for (size_t l = 0; l < fileCounts[f].size(); ++l)
+    {
+      if (lanes[l] >= counts.size())
+        counts.resize(lanes[l] + 1);
+      counts[lanes[l]].add(fileCounts[f][l]);
+    }
+
+    for (std::map<seqan::CharString, unsigned>::const_iterator it = missingLanes[f].begin(); it != missingLanes[f].end(); ++it)
+    {
+      if (laneNames.find(it->first) == laneNames.end())
+        laneNames[it->first] = 0;
+    }
+  }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION hashBamFile()
+// -----------------------------------------------------------------------------
+
+// Hashes one file by itself for --cache. Every read group gets a lane of its
+// own, also those of reads that are not in the header, so the sums can later
+// be put in the lanes they get among any other files, see hashBamFiles().
+
+bool hashBamFile(Baminfo const & info, htsThreadPool & threadPool, const char * bamfile, const char * reference,
+                 int requiredFields, CacheEntry & entry, bool & pairedWarning)
+{
+  seqan::HtsFile inStream(bamfile, "r", reference, &threadPool, requiredFields);
+  getReadGroups(entry.readGroups, std::string(inStream.hdr->text, inStream.hdr->l_text));
+
+  std::map<seqan::CharString, unsigned> lanes;
+  for (size_t i = 0; i < entry.readGroups.size(); i++) {
+    seqan::CharString name = entry.readGroups[i];
+    if (lanes.find(name) == lanes.end()) {
+      unsigned lane = lanes.size();
+      lanes[name] = lane;
+    }
+  }
+  LaneTable table;
+  table.build(lanes);
+
+  HashPipeline pipeline(info.hashThreads, false, info.hash);
+  while (seqan::readRecord(inStream)) {
+    if (!hashRecord(pipeline, inStream.hts_record, lanes, table, info, pairedWarning, true)) {
+      return false;
+    }
+  }
+  std::vector<Counts> counts;
+  pipeline.finish(counts);
+  counts.resize(lanes.size());
+
+  entry.lanes.clear();
+  for (std::map<seqan::CharString, unsigned>::const_iterator it = lanes.begin(); it != lanes.end(); ++it) {
+    entry.lanes.push_back(std::make_pair(std::string(toCString(it->first)), counts[it->second]));
+  }
+  return true;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION hashBamFiles()
+// -----------------------------------------------------------------------------
+
+bool hashBamFiles(Baminfo const & info, htsThreadPool & threadPool, std::map<seqan::CharString, unsigned> & laneNames,
+                  std::vector<Counts> & counts, Counts * total)
+{
+  bool pairedWarning = false;
+
+  LaneTable laneTable;
+  // Reads are hashed and summed per lane by the pipeline
+  // --dump-hashes writes every hash on a thread of its own, of all reads or
+  // those in the buckets of --dump-buckets
+  HashDump dump;
+  if (!info.dumpHashes.empty()) {
+    if (!dump.open(info.dumpHashes.c_str(), info.hash)) {
+      return false;
+    }
+    if (!info.dumpBuckets.empty()) {
+      std::vector<char> selected;
+      if (!readBuckets(info.dumpBuckets.c_str(), info.bucketBits, info.hash, selected)) {
+        return false;
+      }
+      dump.selectBuckets(info.bucketBits, selected);
+    }
+  }
+  HashPipeline pipeline(info.hashThreads, info.debug, info.hash, info.dumpHashes.empty() ? NULL : &dump,
+                        info.bucketSums.empty() ? 0 : info.bucketBits, info.iblt.empty() ? 0 : info.ibltCells);
+  // and those of files read with --shards or --cache by their own pipelines
+  std::vector<Counts> shardCounts;
+
+  // CRAM files only decode what goes into the checksum
+  int requiredFields = SAM_FLAG | SAM_SEQ | SAM_RGAUX;
+  if (!info.noReadNames) {
+    requiredFields |= SAM_QNAME;
+  }
+  if (!info.noQuality) {
+    requiredFields |= SAM_QUAL;
+  }
+
+  const char* reference = toCString(info.reference);
+
+  // --debug and the files of all reads need every read in the one pipeline
+  bool onePipeline = info.debug || !info.dumpHashes.empty() || !info.bucketSums.empty() || !info.iblt.empty();
+
+  if (info.cache && !onePipeline) {
+    // Every file is hashed by itself, unless its sidecar is up to date, and
+    // its read groups are put in the lanes that reading the files one after
+    // another gives them, as by addFileCounts()
+    std::string options = cacheOptions("bam", info.hash, info.noReadNames, info.noQuality, info.paired);
+    for (size_t i = 0; i < info.bamfiles.size(); i++) {
+      std::vector<std::string> files(1, info.bamfiles[i]);
+      std::vector<FileFingerprint> prints;
+      bool fingerprinted = fingerprintFiles(files, prints);
+      CacheEntry entry;
+      if (!fingerprinted || info.recompute || !readCache(files, prints, options, entry)) {
+        if (!hashBamFile(info, threadPool, files[0].c_str(), reference, requiredFields, entry, pairedWarning)) {
+          return false;
+        }
+        if (fingerprinted) {
+          writeCache(files, prints, options, entry);
+        }
+      }
+
+      addLaneNames(laneNames, entry.readGroups);
+      for (size_t l = 0; l < entry.lanes.size(); l++) {
+        seqan::CharString name = entry.lanes[l].first;
+        std::map<seqan::CharString, unsigned>::iterator lane = laneNames.find(name);
+        if (lane == laneNames.end()) {
+          lane = laneNames.insert(std::make_pair(name, 0u)).first;
+        }
+        if (lane->second >= shardCounts.size()) {
+          shardCounts.resize(lane->second + 1);
+        }
+        shardCounts[lane->second].add(entry.lanes[l].second);
+      }
+    }
+  } else if (info.shards > 0 && !onePipeline) {
+    // All files are read on the --shards threads: by region if they have an
+    // index, BAM files without one in ranges cut at BGZF blocks, others whole
+    std::vector<std::string> headers;
+    std::vector<std::map<seqan::CharString, unsigned> > fileLanes;
+    std::map<seqan::CharString, unsigned> knownLanes;
+    std::vector<Shard> shards;
+    for (unsigned i = 0; i < info.bamfiles.size(); i++) {
+      const char* bamfile = info.bamfiles[i].c_str();
+      seqan::HtsFile inStream(bamfile, "r", reference, &threadPool, requiredFields);
+
+      headers.push_back(std::string(inStream.hdr->text, inStream.hdr->l_text));
+      std::map<seqan::CharString, unsigned> headerLanes;
+      getLaneNames(headerLanes, headers.back());
+      for (std::map<seqan::CharString, unsigned>::iterator it = headerLanes.begin(); it != headerLanes.end(); ++it) {
+        if (knownLanes.find(it->first) == knownLanes.end()) {
+          unsigned lane = knownLanes.size() + 1;
+          knownLanes[it->first] = lane;
+        }
+      }
+      fileLanes.push_back(knownLanes);
+
+      htsFormat const * format = hts_get_format(inStream.fp);
+      if (loadIndex(inStream)) {
+        makeShards(shards, i, inStream.hdr, inStream.hts_index, info.shards);
+      } else if (format->format == bam && format->compression == bgzf) {
+        BGZF * bgzf = inStream.fp->fp.bgzf;
+        makeShards(shards, i, splitBam(bgzf, bamfile, inStream.hdr, bgzf_tell(bgzf), 4 * info.shards));
+      } else {
+        Shard shard = {Shard::WHOLE_FILE, i, -1, 0, 0, -1, -1};
+        shards.push_back(shard);
+      }
+    }
+
+    std::vector<std::vector<Counts> > fileCounts;
+    std::vector<std::map<seqan::CharString, unsigned> > missingLanes;
+    std::vector<unsigned> reread;
+    ShardReader reader(info.bamfiles, fileLanes, reference, &threadPool, requiredFields, info, shards);
+    if (!reader.run(info.shards, fileCounts, missingLanes, pairedWarning, reread)) {
+      return false;
+    }
+
+    for (size_t i = 0; i < reread.size(); i++) {
+      unsigned f = reread[i];
+      const char* bamfile = info.bamfiles[f].c_str();
+      std::cerr << "WARNING: Could not split " << bamfile << " between records, it is read from start to end\n";
+
+      seqan::HtsFile inStream(bamfile, "r", reference, &threadPool, requiredFields);
+      std::map<seqan::CharString, unsigned> lanes = fileLanes[f];
+      LaneTable table;
+      table.build(lanes);
+      HashPipeline filePipeline(info.hashThreads, false, info.hash);
+      while (seqan::readRecord(inStream)) {
+        if (!hashRecord(filePipeline, inStream.hts_record, lanes, table, info, pairedWarning)) {
+          return false;
+        }
+      }
+      filePipeline.finish(fileCounts[f]);
+      addMissingLanes(missingLanes[f], lanes, fileLanes[f]);
+    }
+
+    addFileCounts(shardCounts, laneNames, headers, fileLanes, fileCounts, missingLanes);
+  } else {
+    for (size_t i = 0; i < info.bamfiles.size(); i++) {
+
+      const char* bamfile = info.bamfiles[i].c_str();
+
+      // Open stream for reading
+      seqan::HtsFile inStream(bamfile, "r", reference, &threadPool, requiredFields);
+
+      // Initialize lane names (read groups).
+      std::string header(inStream.hdr->text, inStream.hdr->l_text);
+      getLaneNames(laneNames, header);
+      laneTable.build(laneNames);
+
+      // Read record, the hashed string is built straight from the htslib record
+      while (seqan::readRecord(inStream)){
+        if (!hashRecord(pipeline, inStream.hts_record, laneNames, laneTable, info, pairedWarning)) {
+          return false;
+        }
+      }
+    }
+  }
+
+  pipeline.finish(counts);
+  if (!dump.close()) {
+    return false;
+  }
+  if (!info.bucketSums.empty() && !writeBucketSums(info.bucketSums.c_str(), pipeline.bucketSums(), info.hash)) {
+    return false;
+  }
+  if (!info.iblt.empty() && !pipeline.readTable().write(info.iblt.c_str(), info.hash)) {
+    return false;
+  }
+  if (shardCounts.size() > counts.size()) {
+    counts.resize(shardCounts.size());
+  }
+  for (size_t l = 0; l < shardCounts.size(); ++l) {
+    counts[l].add(shardCounts[l]);
+  }
+  // also the lanes that are cut off below
+  if (total != NULL) {
+    for (size_t l = 0; l < counts.size(); ++l) {
+      total->add(counts[l]);
+    }
+  }
+  counts.resize(laneNames.size());
+  return true;
+}
+
+// -----------------------------------------------------------------------------
+// STRUCT ScopedThreadPool
+// -----------------------------------------------------------------------------
+
+// The htslib thread pool of --threads, released and its threads joined on
+// every way out of hashBamFiles(). The files using it are closed before.
+
+struct ScopedThreadPool
+{
+  htsThreadPool threadPool;
+
+  ScopedThreadPool()
+  {
+    threadPool.pool = NULL;
+    threadPool.qsize = 0;
+  }
+
+  ~ScopedThreadPool()
+  {
+    if (threadPool.pool != NULL)
+      hts_tpool_destroy(threadPool.pool);
+  }
+};
+
+bool hashBamFiles(Baminfo const & info, std::map<seqan::CharString, unsigned> & laneNames, std::vector<Counts> & counts,
+                  Counts * total)
+{
+  // One thread pool shared by all input files, decompression overlaps hashing
+  ScopedThreadPool scopedPool;
+  if (info.threads > 0) {
+    scopedPool.threadPool.pool = hts_tpool_init(info.threads);
+    if (scopedPool.threadPool.pool == NULL) {
+      std::cerr << "ERROR: Could not create a pool of " << info.threads << " threads\n";
+      return false;
+    }
+  }
+
+  return hashBamFiles(info, scopedPool.threadPool, laneNames, counts, total);
+}
@@ -0,0 +1,49 @@
+#ifndef BAMHASH_BAM_H
+#define BAMHASH_BAM_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <seqan/sequence.h>
+
+#include "bamhash_checksum_common.h"
+#include "bamhash_iblt.h"
+
+// Options of the SAM, BAM and CRAM checksum, see bamhash_checksum_bam.
+struct Baminfo {
+  std::vector<std::string>  bamfiles;
+  bool debug;
+  bool noReadNames;
+  bool noQuality;
+  bool paired;
+  int threads;
+  int hashThreads;
+  int shards;
+  HashFunction hash;
+  int sumBits;
+  seqan::CharString reference;
+  std::string dumpHashes;
+  std::string dumpBuckets;
+  std::string bucketSums;
+  int bucketBits;
+  std::string iblt;
+  int ibltCells;
+  bool cache;
+  bool recompute;
+
+  Baminfo() : debug(false), noReadNames(false), noQuality(false), paired(true), threads(0), hashThreads(0), shards(0), hash(HASH_MD5), sumBits(64), reference(""), bucketBits(16), ibltCells(BAMHASH_IBLT_CELLS), cache(false), recompute(false) {}
+
+};
+
+// Hashes the reads of info.bamfiles and sums them per read group. laneNames
+// maps every read group ID, of the headers and of reads with an RG that no
+// header has, to its Counts in counts. A read group ID that is in the header
+// of more than one file is given a new lane that no ID maps to any more, as
+// it always was, so those reads are not in counts. total, if given, gets the
+// sum of all reads. In debug mode the hashed strings are printed instead.
+// Returns false on an error, after printing it.
+bool hashBamFiles(Baminfo const & info, std::map<seqan::CharString, unsigned> & laneNames, std::vector<Counts> & counts,
+                  Counts * total = NULL);
+
+#endif // BAMHASH_BAM_H
@@ -0,0 +1,171 @@
+#include <string.h>
+#include <stdint.h>
+
+#include "bamhash_blake3.h"
+
+// See https://github.com/BLAKE3-team/BLAKE3-specs, this follows the structure
+// of reference_impl.rs. Like the MD5 kernels this assumes a little endian CPU.
+
+#define CHUNK_START 1
+#define CHUNK_END 2
+#define PARENT 4
+#define ROOT 8
+
+static const uint32_t IV[8] = {
+  0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+// The message words of every round: the permutation {2, 6, 3, 10, 7, 0, 4, 13,
+// 1, 11, 12, 5, 9, 14, 15, 8} applied once per round.
+static const uint8_t MSG_SCHEDULE[7][16] = {
+  {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+  {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+  {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+  {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+  {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+  {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+  {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+};
+
+static inline uint32_t rotr32(uint32_t x, int r) {
+  return (x >> r) | (x << (32 - r));
+}
+
+static inline void g(uint32_t *s, int a, int b, int c, int d, uint32_t mx, uint32_t my) {
+  s[a] = s[a] + s[b] + mx;
+  s[d] = rotr32(s[d] ^ s[a], 16);
+  s[c] = s[c] + s[d];
+  s[b] = rotr32(s[b] ^ s[c], 12);
+  s[a] = s[a] + s[b] + my;
+  s[d] = rotr32(s[d] ^ s[a], 8);
+  s[c] = s[c] + s[d];
+  s[b] = rotr32(s[b] ^ s[c], 7);
+}
+
+static inline void blake3Round(uint32_t *s, const uint32_t *m, int r) {
+  const uint8_t *w = MSG_SCHEDULE[r];
+  // columns
+  g(s, 0, 4, 8, 12, m[w[0]], m[w[1]]);
+  g(s, 1, 5, 9, 13, m[w[2]], m[w[3]]);
+  g(s, 2, 6, 10, 14, m[w[4]], m[w[5]]);
+  g(s, 3, 7, 11, 15, m[w[6]], m[w[7]]);
+  // diagonals
+  g(s, 0, 5, 10, 15, m[w[8]], m[w[9]]);
+  g(s, 1, 6, 11, 12, m[w[10]], m[w[11]]);
+  g(s, 2, 7, 8, 13, m[w[12]], m[w[13]]);
+  g(s, 3, 4, 9, 14, m[w[14]], m[w[15]]);
+}
+
+// The first 8 words of the compression function's output: the chaining value,
+// or the start of the root output.
+static void compress(const uint32_t *cv, const unsigned char *block, uint64_t counter, int blockLength,
+                     int flags, uint32_t *out) {
+  uint32_t m[16];
+  memcpy(m, block, BAMHASH_BLAKE3_BLOCK);
+
+  uint32_t s[16] = {
+    cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+    IV[0], IV[1], IV[2], IV[3],
+    (uint32_t)counter, (uint32_t)(counter >> 32), (uint32_t)blockLength, (uint32_t)flags
+  };
+
+  blake3Round(s, m, 0);
+  blake3Round(s, m, 1);
+  blake3Round(s, m, 2);
+  blake3Round(s, m, 3);
+  blake3Round(s, m, 4);
+  blake3Round(s, m, 5);
+  blake3Round(s, m, 6);
+
+  for (int i = 0; i < 8; ++i) {
+    out[i] = s[i] ^ s[i + 8];
+  }
+}
+
+static void parentCv(const uint32_t *left, const uint32_t *right, int flags, uint32_t *out) {
+  unsigned char block[BAMHASH_BLAKE3_BLOCK];
+  memcpy(block, left, 32);
+  memcpy(block + 32, right, 32);
+  compress(IV, block, 0, BAMHASH_BLAKE3_BLOCK, PARENT | flags, out);
+}
+
+static void startChunk(Blake3State & state, uint64_t counter) {
+  memcpy(state.cv, IV, sizeof(state.cv));
+  state.chunkCounter = counter;
+  memset(state.block, 0, sizeof(state.block));
+  state.blockLength = 0;
+  state.blocksCompressed = 0;
+}
+
+static int chunkLength(Blake3State const & state) {
+  return BAMHASH_BLAKE3_BLOCK * state.blocksCompressed + state.blockLength;
+}
+
+static int startFlag(Blake3State const & state) {
+  return state.blocksCompressed == 0 ? CHUNK_START : 0;
+}
+
+void blake3Init(Blake3State & state) {
+  startChunk(state, 0);
+  state.stackSize = 0;
+}
+
+void blake3Update(Blake3State & state, const char *data, size_t length) {
+  while (length > 0) {
+    // The chunk is full and more input follows: merge its chaining value into
+    // the tree, one parent per trailing zero bit of the new chunk count.
+    if (chunkLength(state) == BAMHASH_BLAKE3_CHUNK) {
+      uint32_t cv[8];
+      compress(state.cv, state.block, state.chunkCounter, state.blockLength, CHUNK_END | startFlag(state), cv);
+      uint64_t chunks = state.chunkCounter + 1;
+      while ((chunks & 1) == 0) {
+        parentCv(state.stack[--state.stackSize], cv, 0, cv);
+        chunks >>= 1;
+      }
+      memcpy(state.stack[state.stackSize++], cv, sizeof(cv));
+      startChunk(state, state.chunkCounter + 1);
+    }
+
+    // A full block is only compressed once more input follows it.
+    if (state.blockLength == BAMHASH_BLAKE3_BLOCK) {
+      compress(state.cv, state.block, state.chunkCounter, BAMHASH_BLAKE3_BLOCK, startFlag(state), state.cv);
+      ++state.blocksCompressed;
+      memset(state.block, 0, sizeof(state.block));
+      state.blockLength = 0;
+    }
+
+    size_t n = BAMHASH_BLAKE3_BLOCK - state.blockLength;
+    if (n > length) {
+      n = length;
+    }
+    memcpy(state.block + state.blockLength, data, n);
+    state.blockLength += n;
+    data += n;
+    length -= n;
+  }
+}
+
+void blake3Final(Blake3State & state, unsigned char *out) {
+  uint32_t words[8];
+  int flags = CHUNK_END | startFlag(state);
+
+  if (state.stackSize == 0) {
+    compress(state.cv, state.block, state.chunkCounter, state.blockLength, flags | ROOT, words);
+  } else {
+    uint32_t cv[8];
+    compress(state.cv, state.block, state.chunkCounter, state.blockLength, flags, cv);
+    for (int i = state.stackSize - 1; i > 0; --i) {
+      parentCv(state.stack[i], cv, 0, cv);
+    }
+    parentCv(state.stack[0], cv, ROOT, words);
+  }
+
+  memcpy(out, words, 16);
+}
+
+void blake3Hash(const char *str, size_t length, unsigned char *out) {
+  Blake3State state;
+  blake3Init(state);
+  blake3Update(state, str, length);
+  blake3Final(state, out);
+}
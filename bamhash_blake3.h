@@ -0,0 +1,35 @@
+#ifndef BAMHASH_BLAKE3_H
+#define BAMHASH_BLAKE3_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// BLAKE3 in its plain hashing mode, written after the portable reference
+// implementation so the build needs no other library. Only the first 16 bytes
+// of the 32 byte output are used, as hash_t.
+
+#define BAMHASH_BLAKE3_BLOCK 64
+#define BAMHASH_BLAKE3_CHUNK 1024
+
+struct Blake3State {
+  // the chunk being hashed
+  uint32_t cv[8];
+  uint64_t chunkCounter;
+  unsigned char block[BAMHASH_BLAKE3_BLOCK];
+  int blockLength;
+  int blocksCompressed;
+
+  // chaining values of the finished subtrees, at most one per level
+  uint32_t stack[54][8];
+  int stackSize;
+};
+
+void blake3Init(Blake3State & state);
+void blake3Update(Blake3State & state, const char *data, size_t length);
+// Writes the first 16 bytes of the hash to out.
+void blake3Final(Blake3State & state, unsigned char *out);
+
+// The first 16 bytes of the BLAKE3 hash of a string.
+void blake3Hash(const char *str, size_t length, unsigned char *out);
+
+#endif // BAMHASH_BLAKE3_H
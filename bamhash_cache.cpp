@@ -0,0 +1,182 @@
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bamhash_cache.h"
+
+#define BAMHASH_CACHE_HEADER "# bamhash checksum cache 1"
+
+bool FileFingerprint::operator==(FileFingerprint const & other) const
+{
+  return size == other.size && mtime == other.mtime && inode == other.inode &&
+         head.p.low == other.head.p.low && head.p.high == other.head.p.high &&
+         tail.p.low == other.tail.p.low && tail.p.high == other.tail.p.high;
+}
+
+std::string cacheOptions(const char * format, HashFunction function, bool noReadNames, bool noQuality, bool paired) {
+  std::string options = std::string(format) + " " + hashFunctionName(function);
+  options += noReadNames ? " no-readnames" : " readnames";
+  options += noQuality ? " no-quality" : " quality";
+  options += paired ? " paired" : " no-paired";
+  return options;
+}
+
+// The MD5 of length bytes of the file at offset, an empty hash for length 0.
+static bool hashPart(FILE * file, uint64_t offset, size_t length, hash_t & hash) {
+  std::vector<char> buffer(length);
+  if (fseeko(file, offset, SEEK_SET) != 0 ||
+      (length > 0 && fread(&buffer[0], 1, length, file) != length)) {
+    return false;
+  }
+  hash = hashString(HASH_MD5, length > 0 ? &buffer[0] : "", length);
+  return true;
+}
+
+static bool fingerprintFile(const char * fileName, FileFingerprint & print) {
+  struct stat info;
+  if (stat(fileName, &info) != 0) {
+    return false;
+  }
+  print.size = info.st_size;
+  print.mtime = info.st_mtime;
+  print.inode = info.st_ino;
+
+  FILE * file = fopen(fileName, "rb");
+  if (file == NULL) {
+    return false;
+  }
+  size_t probe = print.size < BAMHASH_CACHE_PROBE ? print.size : BAMHASH_CACHE_PROBE;
+  bool ok = hashPart(file, 0, probe, print.head) && hashPart(file, print.size - probe, probe, print.tail);
+  fclose(file);
+  return ok;
+}
+
+bool fingerprintFiles(std::vector<std::string> const & files, std::vector<FileFingerprint> & prints) {
+  prints.resize(files.size());
+  for (size_t i = 0; i < files.size(); i++) {
+    if (!fingerprintFile(files[i].c_str(), prints[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static std::string formatHash(uint64_t high, uint64_t low) {
+  char hex[33];
+  snprintf(hex, sizeof(hex), "%016llx%016llx", (unsigned long long)high, (unsigned long long)low);
+  return hex;
+}
+
+static bool parseHash(std::string const & hex, uint64_t & high, uint64_t & low) {
+  if (hex.size() != 32 || strspn(hex.c_str(), "0123456789abcdef") != 32) {
+    return false;
+  }
+  high = strtoull(hex.substr(0, 16).c_str(), NULL, 16);
+  low = strtoull(hex.substr(16).c_str(), NULL, 16);
+  return true;
+}
+
+// Splits a line of the sidecar at its tabs.
+static std::vector<std::string> splitLine(std::string const & line) {
+  std::vector<std::string> fields;
+  size_t start = 0;
+  for (size_t tab; (tab = line.find('\t', start)) != std::string::npos; start = tab + 1) {
+    fields.push_back(line.substr(start, tab - start));
+  }
+  fields.push_back(line.substr(start));
+  return fields;
+}
+
+bool readCache(std::vector<std::string> const & files, std::vector<FileFingerprint> const & prints,
+               std::string const & options, CacheEntry & entry) {
+  std::ifstream in((files[0] + BAMHASH_CACHE_SUFFIX).c_str());
+  std::string line;
+  if (!in || !std::getline(in, line) || line != BAMHASH_CACHE_HEADER) {
+    return false;
+  }
+
+  entry = CacheEntry();
+  size_t file = 0;
+  bool sameOptions = false;
+  while (std::getline(in, line)) {
+    std::vector<std::string> fields = splitLine(line);
+    if (fields[0] == "options" && fields.size() == 2) {
+      sameOptions = fields[1] == options;
+    } else if (fields[0] == "file" && fields.size() == 7) {
+      FileFingerprint print;
+      print.size = strtoull(fields[2].c_str(), NULL, 10);
+      print.mtime = strtoll(fields[3].c_str(), NULL, 10);
+      print.inode = strtoull(fields[4].c_str(), NULL, 10);
+      if (!parseHash(fields[5], print.head.p.high, print.head.p.low) ||
+          !parseHash(fields[6], print.tail.p.high, print.tail.p.low) ||
+          file >= prints.size() || !(print == prints[file])) {
+        return false;
+      }
+      file++;
+    } else if (fields[0] == "count" && fields.size() == 2) {
+      entry.count = strtoull(fields[1].c_str(), NULL, 10);
+    } else if (fields[0] == "rg" && fields.size() == 2) {
+      entry.readGroups.push_back(fields[1]);
+    } else if (fields[0] == "lane" && fields.size() == 4) {
+      Counts counts;
+      if (!parseHash(fields[1], counts.sumHigh, counts.sum)) {
+        return false;
+      }
+      counts.count = strtoull(fields[2].c_str(), NULL, 10);
+      entry.lanes.push_back(std::make_pair(fields[3], counts));
+    } else if (line == "end") {
+      // only a sidecar that was written to the end counts
+      return sameOptions && file == prints.size();
+    } else {
+      return false;
+    }
+  }
+  return false;
+}
+
+void writeCache(std::vector<std::string> const & files, std::vector<FileFingerprint> const & prints,
+                std::string const & options, CacheEntry const & entry) {
+  std::ostringstream out;
+  out << BAMHASH_CACHE_HEADER << "\n";
+  out << "options\t" << options << "\n";
+  for (size_t i = 0; i < files.size(); i++) {
+    const char * base = strrchr(files[i].c_str(), '/');
+    out << "file\t" << (base == NULL ? files[i].c_str() : base + 1) << "\t" << prints[i].size << "\t" << prints[i].mtime
+        << "\t" << prints[i].inode << "\t" << formatHash(prints[i].head.p.high, prints[i].head.p.low)
+        << "\t" << formatHash(prints[i].tail.p.high, prints[i].tail.p.low) << "\n";
+  }
+  out << "count\t" << entry.count << "\n";
+  for (size_t i = 0; i < entry.readGroups.size(); i++) {
+    out << "rg\t" << entry.readGroups[i] << "\n";
+  }
+  for (size_t i = 0; i < entry.lanes.size(); i++) {
+    Counts const & counts = entry.lanes[i].second;
+    out << "lane\t" << formatHash(counts.sumHigh, counts.sum) << "\t" << counts.count << "\t" << entry.lanes[i].first << "\n";
+  }
+  out << "end\n";
+
+  // written next to the sidecar and renamed, so a run that is cut short
+  // leaves no half a sidecar behind
+  std::string fileName = files[0] + BAMHASH_CACHE_SUFFIX;
+  std::ostringstream tmpName;
+  tmpName << fileName << ".tmp" << getpid();
+  std::string text = out.str();
+  FILE * file = fopen(tmpName.str().c_str(), "w");
+  bool ok = file != NULL;
+  if (ok) {
+    ok = fwrite(text.data(), 1, text.size(), file) == text.size();
+    ok = fclose(file) == 0 && ok;
+    ok = ok && rename(tmpName.str().c_str(), fileName.c_str()) == 0;
+    if (!ok) {
+      unlink(tmpName.str().c_str());
+    }
+  }
+  if (!ok) {
+    std::cerr << "WARNING: Could not write the checksum cache " << fileName << "\n";
+  }
+}
@@ -0,0 +1,74 @@
+#ifndef BAMHASH_CACHE_H
+#define BAMHASH_CACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bamhash_checksum_common.h"
+
+// Appended to the name of an input file for its sidecar.
+#define BAMHASH_CACHE_SUFFIX ".bamhash"
+
+// Bytes at the start and the end of a file that are hashed into its
+// fingerprint: a BGZF block of at most 64KB and the 28 byte empty block that
+// ends a BAM or BGZF file, so the first and the last blocks of data of those
+// are covered. Nothing in between is looked at.
+#define BAMHASH_CACHE_PROBE ((64 << 10) + 28)
+
+// -----------------------------------------------------------------------------
+// STRUCT FileFingerprint
+// -----------------------------------------------------------------------------
+
+// What is checked before the sums in a sidecar are reused: cheap to take, and
+// different once the file is changed, replaced or copied somewhere else, in
+// which case it should be hashed again anyway.
+
+struct FileFingerprint {
+  uint64_t size;
+  int64_t mtime;  // seconds
+  uint64_t inode;
+  hash_t head;    // MD5 of the first BAMHASH_CACHE_PROBE bytes
+  hash_t tail;    // and of the last
+
+  bool operator==(FileFingerprint const & other) const;
+};
+
+// -----------------------------------------------------------------------------
+// STRUCT CacheEntry
+// -----------------------------------------------------------------------------
+
+// The sums of one input file, or pair of FASTQ files, as kept in the sidecar
+// of --cache next to the (first) file.
+
+struct CacheEntry {
+  // The read group IDs of the @RG lines of a SAM, BAM or CRAM header, in order.
+  std::vector<std::string> readGroups;
+  // The sums per read group of the reads, "" for FASTQ.
+  std::vector<std::pair<std::string, Counts> > lanes;
+  // The number of reads (pairs) of FASTQ files.
+  uint64_t count;
+
+  CacheEntry() : count(0) {}
+};
+
+// The options that change the sums, a sidecar is only used by a run with the
+// same ones.
+std::string cacheOptions(const char * format, HashFunction function, bool noReadNames, bool noQuality, bool paired);
+
+// Takes the fingerprints of files. Returns false if one can't be read, the
+// files are then hashed without the cache.
+bool fingerprintFiles(std::vector<std::string> const & files, std::vector<FileFingerprint> & prints);
+
+// Reads the sidecar of files[0]. Returns false if there is none or it does
+// not match prints and options.
+bool readCache(std::vector<std::string> const & files, std::vector<FileFingerprint> const & prints,
+               std::string const & options, CacheEntry & entry);
+
+// Writes the sidecar of files[0], prints are those taken before the files
+// were read. Prints a warning if it can't be written.
+void writeCache(std::vector<std::string> const & files, std::vector<FileFingerprint> const & prints,
+                std::string const & options, CacheEntry const & entry);
+
+#endif // BAMHASH_CACHE_H
@@ -1,40 +1,11 @@
-#include "htslib/hts.h"
-#include <seqan/bam_io.h>
 #include <iostream>
-#include <seqan/stream.h>
-#include <stdio.h>
 #include <stdlib.h>
 #include <string>
-#include <cmath>
-#include <cstdlib>
-#include <stdint.h>
 #include <vector>
 #include <seqan/arg_parse.h>
-#include <seqan/hts_io.h>
-
-
 
 #include "bamhash_checksum_common.h"
-
-struct Baminfo {
-  std::vector<std::string>  bamfiles;
-  bool debug;
-  bool noReadNames;
-  bool noQuality;
-  bool paired;
-  seqan::CharString reference;
-
-  Baminfo() : debug(false), noReadNames(false), noQuality(false), paired(true), reference("") {}
-
-};
-
-struct Counts {
-  uint64_t sum;
-  uint64_t count;
-
-  Counts() : sum(0), count(0) {}
-
-};
+#include "bamhash_bam.h"
 
 seqan::ArgumentParser::ParseResult
 parseCommandLine(Baminfo& options, int argc, char const **argv) {
@@ -61,8 +32,57 @@ parseCommandLine(Baminfo& options, int argc, char const **argv) {
   addOption(parser, seqan::ArgParseOption("P", "no-paired", "Cram files were not generated with paired-end reads"));
   addOption(parser, seqan::ArgParseOption("r", "reference-file", "Path to reference-file if reference not given in header",
                     seqan::ArgParseArgument::INPUT_FILE));
+  addOption(parser, seqan::ArgParseOption("t", "threads", "Number of threads used to decompress BAM and CRAM input, 0 decompresses on the main thread.",
+                    seqan::ArgParseArgument::INTEGER, "INT"));
+  addOption(parser, seqan::ArgParseOption("", "hash-threads", "Number of threads used to hash reads, 0 hashes on the reading thread.",
+                    seqan::ArgParseArgument::INTEGER, "INT"));
+  addOption(parser, seqan::ArgParseOption("", "shards", "Number of threads that read the input files at the same time, largest file first. "
+                    "Indexed BAM and CRAM files are read by region and BAM files without an index in ranges of BGZF blocks, "
+                    "each with its own reader. 0 reads the files one after another.",
+                    seqan::ArgParseArgument::INTEGER, "INT"));
+  addOption(parser, seqan::ArgParseOption("", "dump-hashes", "Writes the hash of every read, with its read group and mate, to a binary file, "
+                    "gzip compressed if the name ends in .gz. The files are then read one after another.",
+                    seqan::ArgParseArgument::STRING, "FILE"));
+  addOption(parser, seqan::ArgParseOption("", "dump-buckets", "Only writes the reads in the buckets listed in a file to --dump-hashes, "
+                    "such as the output of diff on two --bucket-sums files of the same --bucket-bits and --hash.",
+                    seqan::ArgParseArgument::STRING, "FILE"));
+  addOption(parser, seqan::ArgParseOption("", "bucket-sums", "Writes the sums of the hashes in buckets, by the first bits of the hash, to a text file. "
+                    "The files of two sets of reads differ in the buckets of the reads that differ. The files are then read one after another.",
+                    seqan::ArgParseArgument::STRING, "FILE"));
+  addOption(parser, seqan::ArgParseOption("", "bucket-bits", "Bits of the buckets of --bucket-sums and --dump-buckets.",
+                    seqan::ArgParseArgument::STRING, "BITS"));
+  addOption(parser, seqan::ArgParseOption("", "iblt", "Writes an invertible Bloom lookup table of the hashes of the reads to a small binary file. "
+                    "bamhash_diff recovers the reads that differ from the tables of two sets of reads, if there are not too many. "
+                    "The files are then read one after another.",
+                    seqan::ArgParseArgument::STRING, "FILE"));
+  addOption(parser, seqan::ArgParseOption("", "iblt-cells", "Cells of the --iblt table, 32 bytes each. Tables of the same size can be compared, "
+                    "for up to about two thirds as many differing reads.",
+                    seqan::ArgParseArgument::INTEGER, "INT"));
+  addOption(parser, seqan::ArgParseOption("", "cache", "Keeps the sums of every input file in a sidecar next to it, FILE.bamhash, "
+                    "and uses them instead of reading the file again while its size, time, inode and first and last 64KB are the same. "
+                    "A change in the middle of a file that keeps all of those is not noticed."));
+  addOption(parser, seqan::ArgParseOption("", "recompute", "Reads all files again with --cache and rewrites their sidecars."));
+  addOption(parser, seqan::ArgParseOption("", "hash", "Hash function of the reads. Sums of different functions can not be compared, "
+                    "so other functions than md5 print their name in front of the sum.",
+                    seqan::ArgParseArgument::STRING, "NAME"));
+  addOption(parser, seqan::ArgParseOption("", "sum-bits", "Width of the sum of the hashes. 128 bit sums are printed with the hash function and /128 in front.",
+                    seqan::ArgParseArgument::STRING, "BITS"));
 
   setValidValues(parser, "reference-file", "fa");
+  setMinValue(parser, "threads", "0");
+  setDefaultValue(parser, "threads", 0);
+  setMinValue(parser, "hash-threads", "0");
+  setDefaultValue(parser, "hash-threads", 0);
+  setMinValue(parser, "shards", "0");
+  setDefaultValue(parser, "shards", 0);
+  setValidValues(parser, "hash", BAMHASH_HASH_FUNCTIONS);
+  setDefaultValue(parser, "hash", "md5");
+  setValidValues(parser, "sum-bits", "64 128");
+  setDefaultValue(parser, "sum-bits", "64");
+  setValidValues(parser, "bucket-bits", "4 8 12 16 20");
+  setDefaultValue(parser, "bucket-bits", "16");
+  setMinValue(parser, "iblt-cells", "3");
+  setDefaultValue(parser, "iblt-cells", BAMHASH_IBLT_CELLS);
 
   // Parse command line.
   seqan::ArgumentParser::ParseResult res = seqan::parse(parser, argc, argv);
@@ -75,75 +95,31 @@ parseCommandLine(Baminfo& options, int argc, char const **argv) {
   options.noQuality = isSet(parser, "no-quality");
   options.paired = !isSet(parser, "no-paired");
   getOptionValue(options.reference, parser, "reference-file");
+  getOptionValue(options.threads, parser, "threads");
+  getOptionValue(options.hashThreads, parser, "hash-threads");
+  getOptionValue(options.shards, parser, "shards");
+  getOptionValue(options.dumpHashes, parser, "dump-hashes");
+  getOptionValue(options.dumpBuckets, parser, "dump-buckets");
+  getOptionValue(options.bucketSums, parser, "bucket-sums");
+  std::string bucketBits;
+  getOptionValue(bucketBits, parser, "bucket-bits");
+  options.bucketBits = atoi(bucketBits.c_str());
+  getOptionValue(options.iblt, parser, "iblt");
+  getOptionValue(options.ibltCells, parser, "iblt-cells");
+  options.recompute = isSet(parser, "recompute");
+  options.cache = options.recompute || isSet(parser, "cache");
+  std::string hash;
+  getOptionValue(hash, parser, "hash");
+  parseHashFunction(hash, options.hash);
+  std::string sumBits;
+  getOptionValue(sumBits, parser, "sum-bits");
+  options.sumBits = atoi(sumBits.c_str());
 
   options.bamfiles = getArgumentValues(parser, 0);
 
   return seqan::ArgumentParser::PARSE_OK;
 }
 
-
-// -----------------------------------------------------------------------------
-// FUNCTION getSampleIdAndLaneNames()
-// -----------------------------------------------------------------------------
-
-void getLaneNames(std::map<seqan::CharString, unsigned> & laneNames, std::string const & header)
-{
-  for (int i = 0; i < header.size(); /*empty on purpose*/)
-  {
-    auto hdr_find_it = std::find(header.begin() + i, header.end(), '\n');
-    std::string line = header.substr(i, hdr_find_it - header.begin() - i);
-
-    if (line.size() > 7 && line[0] == '@' && line[1] == 'R' && line[2] == 'G' && line[3] == '\t')
-    {
-      for (int j = 0; j < static_cast<int>(line.size()); /*empty on purpose*/)
-      {
-        auto line_find_it = std::find(line.begin() + j, line.end(), '\t');
-        std::string field = line.substr(j, line_find_it - line.begin() - j);
-
-        if (field.size() > 3 && field[0] == 'I' && field[1] == 'D' && field[2] == ':')
-        {
-          seqan::CharString read_group_name = field.substr(3);
-          int read_group_index = laneNames.size();
-          laneNames[read_group_name] = read_group_index;
-        }
-
-        j = std::distance(line.begin(), line_find_it) + 1;
-      }
-    }
-
-    i = std::distance(header.begin(), hdr_find_it) + 1;
-  }
-}
-
-// -----------------------------------------------------------------------------
-// FUNCTION getLane()
-// -----------------------------------------------------------------------------
-
-int getLane(seqan::BamAlignmentRecord & record,
-            seqan::BamTagsDict & tagsDict,
-            std::map<seqan::CharString, unsigned> & laneNames)
-{
-  unsigned tagIdx = 0;
-
-  if (!seqan::findTagKey(tagIdx, tagsDict, "RG"))
-  {
-    std::cerr << "ERROR: Found a read with a missing read group (RG) tag\n";
-    return -1;
-  }
-
-  seqan::CharString read_group;
-
-  if(!seqan::extractTagValue(read_group, tagsDict, tagIdx))
-  {
-    std::cerr << "ERROR: Failed to extract read group (RG) tag value\n";
-    return -1;
-  }
-
-  return laneNames[read_group];
-}
-
-
-
 int main(int argc, char const **argv) {
 
   Baminfo info; // Define structure variable
@@ -153,93 +129,17 @@ int main(int argc, char const **argv) {
     return res == seqan::ArgumentParser::PARSE_ERROR;
   }
 
-//Moving below to struct
-//  uint64_t sum = 0;
-//  uint64_t count = 0;
-  bool pairedWarning = false;
-
-  //adding new stuff
   std::map<seqan::CharString, unsigned> laneNames;
-  // Initialize all counts for each lane.
-  seqan::String<Counts> counts;
-
-  for (int i = 0; i < info.bamfiles.size(); i++) {
-
-    const char* bamfile = info.bamfiles[i].c_str();
-    const char* reference = toCString(info.reference);
-
-    // Open stream for reading
-    seqan::HtsFile inStream(bamfile, "r", reference);
-
-    // Initialize lane names (read groups).
-    std::string header(inStream.hdr->text, inStream.hdr->l_text);
-    getLaneNames(laneNames, header);
-    unsigned lanecount = laneNames.size();
-    resize(counts, lanecount);
-
-    // Define:
-    seqan::BamAlignmentRecord record;
-    seqan::CharString string2hash;
-
-    // Read record
-    while (seqan::readRecord(record, inStream)){
-      seqan::BamTagsDict tagsDict(record.tags);
-      int l = getLane(record, tagsDict, laneNames);
-      if (l == -1) return 1;
-
-      // Check if flag: reverse complement and change record accordingly
-      if (hasFlagRC(record)) {
-        seqan::reverseComplement(record.seq);
-        seqan::reverse(record.qual);
-      }
-      // Check if flag: supplementary and exclude those
-      if (!hasFlagSupplementary(record) && !hasFlagSecondary(record)) {
-        counts[l].count +=1;
-        // Construct one string from record
-        if (!info.noReadNames) {
-          seqan::append(string2hash, record.qName);
-          if(hasFlagLast(record)) {
-            if (info.paired) {
-              seqan::append(string2hash, "/2");
-            } else {
-              if (!pairedWarning) {
-                std::cerr << "WARNING: seqread was run with --no-paired mode, but BAM file has reads marked as second pair" << std::endl;
-                pairedWarning = true;
-              }
-              seqan::append(string2hash, "/1");
-            }
-          } else {
-            seqan::append(string2hash, "/1");
-          }
-        }
-
-        seqan::append(string2hash, record.seq);
-        if (!info.noQuality) {
-          if (length(record.seq) == 1 && record.qual == " ")
-            record.qual = "*";
-          seqan::append(string2hash, record.qual);
-        }
-        seqan::clear(record);
-
-        // Get MD5 hash
-        hash_t hex = str2md5(toCString(string2hash), length(string2hash));
-
-        if (info.debug) {
-          std::cout << string2hash << " " << std::hex << hex.p.low << "\n";
-        } else {
-          hexSum(hex, counts[l].sum);
-        }
-
-        seqan::clear(string2hash);
-      }
-    }
+  std::vector<Counts> counts;
+  if (!hashBamFiles(info, laneNames, counts)) {
+    return 1;
   }
 
   if (!info.debug) {
     for (std::map<seqan::CharString, unsigned>::iterator it = laneNames.begin(); it != laneNames.end(); ++it) {
       std::cout << it->first << "\t";
       int lid = it->second;
-      std::cout << std::hex << counts[lid].sum << "\t";
+      std::cout << formatSum(counts[lid], info.hash, info.sumBits) << "\t";
       std::cout << std::dec << counts[lid].count << "\n";
     }
   }
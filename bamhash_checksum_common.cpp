@@ -2,6 +2,7 @@
 #include <sstream>
 #include <openssl/md5.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #include "bamhash_checksum_common.h"
 
@@ -13,7 +14,171 @@ hash_t str2md5(const char *str, int length) {
   return out;
 }
 
-void hexSum(hash_t out, uint64_t& sum) {
-  sum += out.p.low;
+const char * hashFunctionName(HashFunction function) {
+  switch (function) {
+    case HASH_XXH3_128:
+      return "xxh3-128";
+    case HASH_BLAKE3:
+      return "blake3";
+    default:
+      return "md5";
+  }
 }
 
+bool parseHashFunction(std::string const & name, HashFunction & function) {
+  static const HashFunction functions[] = {HASH_MD5, HASH_XXH3_128, HASH_BLAKE3};
+  for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); ++i) {
+    if (name == hashFunctionName(functions[i])) {
+      function = functions[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+const char * sumPrefix(HashFunction function) {
+  switch (function) {
+    case HASH_XXH3_128:
+      return "xxh3-128:";
+    case HASH_BLAKE3:
+      return "blake3:";
+    default:
+      return "";
+  }
+}
+
+hash_t hashString(HashFunction function, const char *str, size_t length) {
+  hash_t out;
+  switch (function) {
+    case HASH_XXH3_128:
+      xxh3Hash(str, length, out.c);
+      break;
+    case HASH_BLAKE3:
+      blake3Hash(str, length, out.c);
+      break;
+    default:
+      out = str2md5(str, length);
+  }
+  return out;
+}
+
+void hashBatch(HashFunction function, const char * const *strs, const int *lengths, hash_t *out, size_t n) {
+  if (function == HASH_MD5) {
+    str2md5Batch(strs, lengths, out, n);
+    return;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = hashString(function, strs[i], lengths[i]);
+  }
+}
+
+void HashStream::init() {
+  switch (function) {
+    case HASH_XXH3_128:
+      xxh3Init(xxh3);
+      break;
+    case HASH_BLAKE3:
+      blake3Init(blake3);
+      break;
+    default:
+      MD5_Init(&md5);
+  }
+}
+
+void HashStream::update(const char *data, size_t length) {
+  switch (function) {
+    case HASH_XXH3_128:
+      xxh3Update(xxh3, data, length);
+      break;
+    case HASH_BLAKE3:
+      blake3Update(blake3, data, length);
+      break;
+    default:
+      MD5_Update(&md5, data, length);
+  }
+}
+
+hash_t HashStream::final() {
+  hash_t out;
+  switch (function) {
+    case HASH_XXH3_128:
+      xxh3Final(xxh3, out.c);
+      break;
+    case HASH_BLAKE3:
+      blake3Final(blake3, out.c);
+      break;
+    default:
+      MD5_Final(out.c, &md5);
+  }
+  return out;
+}
+
+TextView firstField(TextView const & id, char sep) {
+  const char *begin = id.data;
+  const char *end = id.data + id.size;
+  while (begin < end && *begin == sep) {
+    ++begin;
+  }
+  const char *stop = static_cast<const char *>(memchr(begin, sep, end - begin));
+  return TextView(begin, (stop ? stop : end) - begin);
+}
+
+TextView readName(TextView const & id) {
+  if (id.size >= 2 && id.data[id.size - 2] == '/' && (id.data[id.size - 1] == '1' || id.data[id.size - 1] == '2')) {
+    return firstField(id, '/');
+  }
+  return firstField(id, ' ');
+}
+
+std::string formatSum(Counts const & counts, HashFunction function, int bits) {
+  char buf[64];
+  if (bits == 128) {
+    snprintf(buf, sizeof(buf), "%s/128:%016llx%016llx", hashFunctionName(function),
+             (unsigned long long)counts.sumHigh, (unsigned long long)counts.sum);
+  } else {
+    snprintf(buf, sizeof(buf), "%s%llx", sumPrefix(function), (unsigned long long)counts.sum);
+  }
+  return buf;
+}
+
+void HashBatch::hash(HashFunction function) {
+  const char *strs[BAMHASH_BATCH_SIZE];
+  int lengths[BAMHASH_BATCH_SIZE];
+  hash_t out[BAMHASH_BATCH_SIZE];
+  size_t index[BAMHASH_BATCH_SIZE];
+  size_t n = 0;
+
+  for (size_t i = 0; i < size; ++i) {
+    if (hashed[i]) {
+      continue;
+    }
+    TextView str = read(i);
+    strs[n] = str.data;
+    lengths[n] = str.size;
+    index[n++] = i;
+  }
+
+  if (n == size) {
+    hashBatch(function, strs, lengths, &hashes[0], size);
+    return;
+  }
+
+  hashBatch(function, strs, lengths, out, n);
+  for (size_t i = 0; i < n; ++i) {
+    hashes[index[i]] = out[i];
+  }
+}
+
+void HashBatch::sum(std::vector<Counts> & counts, BucketSums * buckets) const {
+  for (size_t i = 0; i < size; ++i) {
+    if (lanes[i] >= (int)counts.size()) {
+      counts.resize(lanes[i] + 1);
+    }
+    counts[lanes[i]].add(hashes[i]);
+  }
+  if (buckets != NULL) {
+    for (size_t i = 0; i < size; ++i) {
+      buckets->add(hashes[i]);
+    }
+  }
+}
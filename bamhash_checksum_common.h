@@ -3,8 +3,24 @@
 
 #define BAMHASH_VERSION "1.3"
 
+// Reads collected before they are hashed together by hashBatch(), a batch is
+// also cut once its strings add up to BAMHASH_BATCH_BYTES.
+#define BAMHASH_BATCH_SIZE 1024
+#define BAMHASH_BATCH_BYTES (4 << 20)
+
+// Reads whose hashed string is at least this long are hashed while they are
+// read, with a HashStream, instead of being copied into a batch.
+#define BAMHASH_STREAM_BYTES (1 << 20)
+
 #include <string>
+#include <vector>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+#include <openssl/md5.h>
+
+#include "bamhash_xxh3.h"
+#include "bamhash_blake3.h"
 
 union hash_t {
   unsigned char c[16];
@@ -15,7 +31,198 @@ union hash_t {
 };
 
 hash_t str2md5(const char *str, int length);
-void hexSum(hash_t out, uint64_t& sum);
+
+// Hashes n independent strings, out[i] = str2md5(strs[i], lengths[i]).
+// Uses a multi-buffer AVX2/AVX-512 kernel when the CPU has one (bamhash_md5.cpp).
+void str2md5Batch(const char * const *strs, const int *lengths, hash_t *out, size_t n);
+
+// Hash functions for the string of a read, chosen with --hash. MD5 is the
+// default and the only one older versions had. Every function gives a 128 bit
+// hash_t, see Counts for how they are summed.
+enum HashFunction {
+  HASH_MD5,
+  HASH_XXH3_128,
+  HASH_BLAKE3
+};
+
+// Valid values of --hash.
+#define BAMHASH_HASH_FUNCTIONS "md5 xxh3-128 blake3"
+
+// The name of the function as given to --hash.
+const char * hashFunctionName(HashFunction function);
+// False if name is not one of BAMHASH_HASH_FUNCTIONS.
+bool parseHashFunction(std::string const & name, HashFunction & function);
+// Printed in front of every sum: nothing for MD5, so its output is unchanged,
+// else the name and a colon, so sums of different functions are never mixed up.
+const char * sumPrefix(HashFunction function);
+
+hash_t hashString(HashFunction function, const char *str, size_t length);
+
+// Hashes n independent strings, out[i] = hashString(function, strs[i], lengths[i]).
+void hashBatch(HashFunction function, const char * const *strs, const int *lengths, hash_t *out, size_t n);
+
+// Hash of a string that is fed in pieces, gives the same hash as hashString()
+// of the concatenation. append() matches std::string, so code that builds the
+// hashed string of a read can write to either.
+struct HashStream {
+  HashFunction function;
+  union {
+    MD5_CTX md5;
+    Xxh3State xxh3;
+    Blake3State blake3;
+  };
+
+  HashStream(HashFunction function_ = HASH_MD5) : function(function_) { init(); }
+
+  void init();
+  void update(const char *data, size_t length);
+  hash_t final();
+
+  HashStream & append(const char *data, size_t length) {
+    update(data, length);
+    return *this;
+  }
+
+  HashStream & append(const char *str) {
+    update(str, strlen(str));
+    return *this;
+  }
+};
+
+// A piece of text owned by someone else.
+struct TextView {
+  const char *data;
+  size_t size;
+
+  TextView() : data(""), size(0) {}
+  TextView(const char *data, size_t size) : data(data), size(size) {}
+  TextView(std::string const & str) : data(str.data()), size(str.size()) {}
+};
+
+// The part of a read id up to the first sep. Like seqan::strSplit(), leading
+// separators are skipped. Points into id, nothing is copied.
+TextView firstField(TextView const & id, char sep);
+
+// The read name in a FASTQ id line: everything up to a "/1" or "/2" suffix, or
+// else up to the first space.
+TextView readName(TextView const & id);
+
+// The hashes of a read group are summed as 128 bit numbers, modulo 2^128. The
+// low half of that is the 64 bit sum of the low halves that BamHash has always
+// printed; the full sum (--sum-bits 128) makes it 2^-128 unlikely that two
+// different sets of reads give the same checksum. Sums of parts of the input,
+// such as those of the hashing threads, are simply added up.
+struct Counts {
+  uint64_t sum;     // low 64 bits
+  uint64_t sumHigh; // high 64 bits
+  uint64_t count;
+
+  Counts() : sum(0), sumHigh(0), count(0) {}
+
+  void add(hash_t hash) {
+    sum += hash.p.low;
+    sumHigh += hash.p.high + (sum < hash.p.low);
+    count += 1;
+  }
+
+  void add(Counts const & other) {
+    sum += other.sum;
+    sumHigh += other.sumHigh + (sum < other.sum);
+    count += other.count;
+  }
+
+};
+
+// Partial sums of the hashes in 2^bits buckets, by the top bits of the high
+// half of the hash; only the low halves are summed. Two sets of reads that
+// differ in a few reads differ in a few buckets, see --bucket-sums. No
+// buckets with bits == 0.
+struct BucketSums {
+  unsigned bits;
+  std::vector<uint64_t> sums;
+
+  BucketSums(unsigned bits_ = 0) : bits(bits_), sums(bits_ == 0 ? 0 : (size_t)1 << bits_) {}
+
+  // The bucket of a hash, for bits > 0.
+  static size_t bucket(hash_t hash, unsigned bits) {
+    return hash.p.high >> (64 - bits);
+  }
+
+  void add(hash_t hash) {
+    if (bits > 0) {
+      sums[bucket(hash, bits)] += hash.p.low;
+    }
+  }
+
+  void add(BucketSums const & other) {
+    for (size_t b = 0; b < sums.size() && b < other.sums.size(); ++b) {
+      sums[b] += other.sums[b];
+    }
+  }
+};
+
+// The checksum as printed: the sum in hex with sumPrefix() in front, or with
+// bits == 128 the name of the hash function, "/128:" and all 32 hex digits of
+// the full sum, so it can't be mixed up with a 64 bit sum.
+std::string formatSum(Counts const & counts, HashFunction function, int bits);
+
+// The strings of up to BAMHASH_BATCH_SIZE reads, hashed in one hashBatch()
+// call. The strings lie one after another in a single arena, read i starts at
+// offsets[i], so filling a batch allocates nothing once the arena has grown
+// to its working size. lanes[i] is the read group (lane) that read i is
+// counted in, mates[i] the 1 or 2 of its "/1" or "/2" suffix. Reads added
+// with addHash() were hashed by the caller, hashed[i] is set for those.
+struct HashBatch {
+  std::string arena;
+  std::vector<size_t> offsets;
+  std::vector<int> lanes;
+  std::vector<char> mates;
+  std::vector<hash_t> hashes;
+  std::vector<char> hashed;
+  size_t size;
+
+  HashBatch() : offsets(BAMHASH_BATCH_SIZE), lanes(BAMHASH_BATCH_SIZE), mates(BAMHASH_BATCH_SIZE), hashes(BAMHASH_BATCH_SIZE), hashed(BAMHASH_BATCH_SIZE), size(0) {}
+
+  // Starts the next read in the batch. Returns the arena: the string of the
+  // read is what is appended to it until the next add().
+  std::string & add(int lane = 0, int mate = 1) {
+    offsets[size] = arena.size();
+    lanes[size] = lane;
+    mates[size] = mate;
+    hashed[size] = false;
+    ++size;
+    return arena;
+  }
+
+  // Adds a read that is hashed already.
+  void addHash(hash_t hash, int lane = 0, int mate = 1) {
+    add(lane, mate);
+    hashes[size - 1] = hash;
+    hashed[size - 1] = true;
+  }
+
+  // The string of read i, valid until the next add().
+  TextView read(size_t i) const {
+    size_t end = i + 1 < size ? offsets[i + 1] : arena.size();
+    return TextView(arena.data() + offsets[i], end - offsets[i]);
+  }
+
+  bool full() const {
+    return size == BAMHASH_BATCH_SIZE || arena.size() >= BAMHASH_BATCH_BYTES;
+  }
+
+  // Fills hashes[0..size).
+  void hash(HashFunction function = HASH_MD5);
+
+  // Adds the hashes to the sum and count of their lanes, growing counts as
+  // needed, and to buckets if there are any.
+  void sum(std::vector<Counts> & counts, BucketSums * buckets = NULL) const;
+
+  void clear() {
+    size = 0;
+    arena.clear();
+  }
+};
 
 
 #endif // BAMHASH_CHECKSUM_COMMON_H
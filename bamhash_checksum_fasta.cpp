@@ -11,13 +11,26 @@
 #include <seqan/arg_parse.h>
 
 #include "bamhash_checksum_common.h"
+#include "bamhash_pipeline.h"
+#include "bamhash_seqfile.h"
 
 struct Fastainfo {
   std::vector<std::string> fastafiles;
   bool debug;
   bool noReadNames;
+  int threads;
+  int hashThreads;
+  int files;
+  HashFunction hash;
+  int sumBits;
+  std::string dumpHashes;
+  std::string dumpBuckets;
+  std::string bucketSums;
+  int bucketBits;
+  std::string iblt;
+  int ibltCells;
 
-  Fastainfo() : debug(false), noReadNames(false) {}
+  Fastainfo() : debug(false), noReadNames(false), threads(0), hashThreads(0), files(0), hash(HASH_MD5), sumBits(64), bucketBits(16), ibltCells(BAMHASH_IBLT_CELLS) {}
 
 };
 
@@ -41,6 +54,51 @@ parseCommandLine(Fastainfo& options, int argc, char const **argv) {
   //add debug option:
   addOption(parser, seqan::ArgParseOption("d", "debug", "Debug mode. Prints full hex for each read to stdout"));
   addOption(parser, seqan::ArgParseOption("R", "no-readnames", "Do not use read names as part of checksum"));
+  addOption(parser, seqan::ArgParseOption("t", "threads", "Number of threads used to decompress gzip and BGZF input, 0 leaves it to seqan's reader.",
+                    seqan::ArgParseArgument::INTEGER, "INT"));
+  addOption(parser, seqan::ArgParseOption("", "hash-threads", "Number of threads used to hash reads, 0 hashes on the reading thread.",
+                    seqan::ArgParseArgument::INTEGER, "INT"));
+  addOption(parser, seqan::ArgParseOption("", "files", "Number of files read at the same time, largest first. "
+                    "Each is read and hashed on a thread of its own. 0 reads them one after another.",
+                    seqan::ArgParseArgument::INTEGER, "INT"));
+  addOption(parser, seqan::ArgParseOption("", "dump-hashes", "Writes the hash of every read, with its read group and mate, to a binary file, "
+                    "gzip compressed if the name ends in .gz. The files are then read one after another.",
+                    seqan::ArgParseArgument::STRING, "FILE"));
+  addOption(parser, seqan::ArgParseOption("", "dump-buckets", "Only writes the reads in the buckets listed in a file to --dump-hashes, "
+                    "such as the output of diff on two --bucket-sums files of the same --bucket-bits and --hash.",
+                    seqan::ArgParseArgument::STRING, "FILE"));
+  addOption(parser, seqan::ArgParseOption("", "bucket-sums", "Writes the sums of the hashes in buckets, by the first bits of the hash, to a text file. "
+                    "The files of two sets of reads differ in the buckets of the reads that differ. The files are then read one after another.",
+                    seqan::ArgParseArgument::STRING, "FILE"));
+  addOption(parser, seqan::ArgParseOption("", "bucket-bits", "Bits of the buckets of --bucket-sums and --dump-buckets.",
+                    seqan::ArgParseArgument::STRING, "BITS"));
+  addOption(parser, seqan::ArgParseOption("", "iblt", "Writes an invertible Bloom lookup table of the hashes of the reads to a small binary file. "
+                    "bamhash_diff recovers the reads that differ from the tables of two sets of reads, if there are not too many. "
+                    "The files are then read one after another.",
+                    seqan::ArgParseArgument::STRING, "FILE"));
+  addOption(parser, seqan::ArgParseOption("", "iblt-cells", "Cells of the --iblt table, 32 bytes each. Tables of the same size can be compared, "
+                    "for up to about two thirds as many differing reads.",
+                    seqan::ArgParseArgument::INTEGER, "INT"));
+  addOption(parser, seqan::ArgParseOption("", "hash", "Hash function of the reads. Sums of different functions can not be compared, "
+                    "so other functions than md5 print their name in front of the sum.",
+                    seqan::ArgParseArgument::STRING, "NAME"));
+  addOption(parser, seqan::ArgParseOption("", "sum-bits", "Width of the sum of the hashes. 128 bit sums are printed with the hash function and /128 in front.",
+                    seqan::ArgParseArgument::STRING, "BITS"));
+
+  setMinValue(parser, "threads", "0");
+  setDefaultValue(parser, "threads", 0);
+  setMinValue(parser, "hash-threads", "0");
+  setDefaultValue(parser, "hash-threads", 0);
+  setMinValue(parser, "files", "0");
+  setDefaultValue(parser, "files", 0);
+  setValidValues(parser, "hash", BAMHASH_HASH_FUNCTIONS);
+  setDefaultValue(parser, "hash", "md5");
+  setValidValues(parser, "sum-bits", "64 128");
+  setDefaultValue(parser, "sum-bits", "64");
+  setValidValues(parser, "bucket-bits", "4 8 12 16 20");
+  setDefaultValue(parser, "bucket-bits", "16");
+  setMinValue(parser, "iblt-cells", "3");
+  setDefaultValue(parser, "iblt-cells", BAMHASH_IBLT_CELLS);
 
   // Parse command line.
   seqan::ArgumentParser::ParseResult res = seqan::parse(parser, argc, argv);
@@ -50,6 +108,23 @@ parseCommandLine(Fastainfo& options, int argc, char const **argv) {
 
   options.debug = seqan::isSet(parser, "debug");
   options.noReadNames = seqan::isSet(parser, "no-readnames");
+  seqan::getOptionValue(options.threads, parser, "threads");
+  seqan::getOptionValue(options.hashThreads, parser, "hash-threads");
+  seqan::getOptionValue(options.files, parser, "files");
+  seqan::getOptionValue(options.dumpHashes, parser, "dump-hashes");
+  seqan::getOptionValue(options.dumpBuckets, parser, "dump-buckets");
+  seqan::getOptionValue(options.bucketSums, parser, "bucket-sums");
+  std::string bucketBits;
+  seqan::getOptionValue(bucketBits, parser, "bucket-bits");
+  options.bucketBits = atoi(bucketBits.c_str());
+  seqan::getOptionValue(options.iblt, parser, "iblt");
+  seqan::getOptionValue(options.ibltCells, parser, "iblt-cells");
+  std::string hash;
+  seqan::getOptionValue(hash, parser, "hash");
+  parseHashFunction(hash, options.hash);
+  std::string sumBits;
+  seqan::getOptionValue(sumBits, parser, "sum-bits");
+  options.sumBits = atoi(sumBits.c_str());
 
 
   options.fastafiles = getArgumentValues(parser, 0);
@@ -58,82 +133,173 @@ parseCommandLine(Fastainfo& options, int argc, char const **argv) {
   return seqan::ArgumentParser::PARSE_OK;
 }
 
-int main(int argc, char const **argv) {
-  Fastainfo info; // Define structure variable
-  seqan::ArgumentParser::ParseResult res = parseCommandLine(info, argc, argv); // Parse the command line.
+// -----------------------------------------------------------------------------
+// FUNCTION hashFasta()
+// -----------------------------------------------------------------------------
 
-  if (res != seqan::ArgumentParser::PARSE_OK) {
-    return res == seqan::ArgumentParser::PARSE_ERROR;
-  }
-
-  // Define:
-  uint64_t sum = 0;
-  unsigned count = 0;
-  seqan::StringSet<seqan::CharString> idSub;
-  seqan::CharString string2hash;
+// Hashes the sequences of one FASTA file. count is the number of sequences so
+// far. Returns false on an error, after printing it.
 
+bool hashFasta(HashPipeline & pipeline, const char * fasta, Fastainfo const & info, unsigned & count)
+{
   seqan::CharString id;
   seqan::CharString seq;
-  hash_t hex;
 
   // Open stream
-  seqan::SeqFileIn seqFileIn;
+  SeqFile seqFile;
+  seqan::SeqFileIn & seqFileIn = seqFile.in;
 
-  for (int i = 0; i < info.fastafiles.size(); i++) {
-    const char* fasta = info.fastafiles[i].c_str();
-    
-    if (!open(seqFileIn, fasta)) {
-      std::cerr << "ERROR: Could not open the file: " << fasta << " for reading.\n";
-      return 1;
-    }
+  if (!seqFile.open(fasta, info.threads)) {
+    std::cerr << "ERROR: Could not open the file: " << fasta << " for reading.\n";
+    return false;
+  }
 
-    // Read record
-    while (!seqan::atEnd(seqFileIn)) {
-      try
-      {
-        readRecord(id, seq, seqFileIn);
+  // Read record
+  while (true) {
+    try
+    {
+      if (seqan::atEnd(seqFileIn)) {
+        break;
       }
-      catch (seqan::Exception const & e)
-      {
-        if (seqan::atEnd(seqFileIn)) {
-          std::cerr << "WARNING: Could not continue reading " << fasta <<  " at line: " << count+1 << ".\n";
-          return 1;
-        }
-        std::cerr << "ERROR: Could not read from " << fasta << "\n";
-        return 1;
+      readRecord(id, seq, seqFileIn);
+    }
+    catch (seqan::IOError const & e)
+    {
+      // thrown by the BGZF stream of -t on a broken block
+      std::cerr << "ERROR: Could not inflate " << fasta << ": " << e.what() << "\n";
+      return false;
+    }
+    catch (seqan::Exception const & e)
+    {
+      if (seqFile.readError(fasta)) {
+        return false;
       }
+      if (seqan::atEnd(seqFileIn)) {
+        std::cerr << "WARNING: Could not continue reading " << fasta <<  " at line: " << count+1 << ".\n";
+        return false;
+      }
+      std::cerr << "ERROR: Could not read from " << fasta << "\n";
+      return false;
+    }
 
-      count +=1;
+    count +=1;
 
-      // cut away after first space
-      seqan::strSplit(idSub, id, seqan::EqualsChar<' '>(), false, 1);
+    // cut away after first space
+    TextView name = firstField(TextView(toCString(id), length(id)), ' ');
 
+    HashBatch & batch = pipeline.batch();
+    // Long contigs are hashed as they are, without a copy
+    if (pipeline.streams(name.size + length(seq))) {
+      HashStream stream(pipeline.hashFunction());
       if (!info.noReadNames) {
-        seqan::append(string2hash, idSub[0]);
+        stream.append(name.data, name.size);
+        stream.append("/1");
+      }
+      stream.append(toCString(seq), length(seq));
+      batch.addHash(stream.final());
+    } else {
+      std::string & string2hash = batch.add();
+      if (!info.noReadNames) {
+        string2hash.append(name.data, name.size);
         seqan::append(string2hash, "/1"); // to be consistent with BAM and FASTQ
       }
       seqan::append(string2hash, seq);
+    }
+
+    // Hand the batch over for hashing once it is full
+    if (batch.full()) {
+      pipeline.submit();
+    }
+  }
+
+  // a broken gzip file can end on a record boundary
+  if (seqFile.readError(fasta)) {
+    return false;
+  }
+
+  seqFile.close();
+  return true;
+}
+
+// -----------------------------------------------------------------------------
+// CLASS FastaJob
+// -----------------------------------------------------------------------------
 
-      // Get MD5 hash
-      hex = str2md5(toCString(string2hash), length(string2hash));
+// A file read with --files, see hashJobs().
 
-      if (info.debug) {
-        std::cout << string2hash << " " <<   std::hex << hex.p.low << "\n";
-      } else {
-        hexSum(hex, sum);
+struct FastaJob
+{
+  Fastainfo const & info;
+
+  FastaJob(Fastainfo const & info_) : info(info_) {}
+
+  bool operator()(HashPipeline & pipeline, unsigned job, unsigned & count) const
+  {
+    return hashFasta(pipeline, info.fastafiles[job].c_str(), info, count);
+  }
+};
+
+int main(int argc, char const **argv) {
+  Fastainfo info; // Define structure variable
+  seqan::ArgumentParser::ParseResult res = parseCommandLine(info, argc, argv); // Parse the command line.
+
+  if (res != seqan::ArgumentParser::PARSE_OK) {
+    return res == seqan::ArgumentParser::PARSE_ERROR;
+  }
+
+  // Define:
+  unsigned count = 0;
+  // --dump-hashes writes every hash on a thread of its own, of all reads or
+  // those in the buckets of --dump-buckets
+  HashDump dump;
+  if (!info.dumpHashes.empty()) {
+    if (!dump.open(info.dumpHashes.c_str(), info.hash)) {
+      return 1;
+    }
+    if (!info.dumpBuckets.empty()) {
+      std::vector<char> selected;
+      if (!readBuckets(info.dumpBuckets.c_str(), info.bucketBits, info.hash, selected)) {
+        return 1;
       }
+      dump.selectBuckets(info.bucketBits, selected);
+    }
+  }
+  HashPipeline pipeline(info.hashThreads, info.debug, info.hash, info.dumpHashes.empty() ? NULL : &dump,
+                        info.bucketSums.empty() ? 0 : info.bucketBits, info.iblt.empty() ? 0 : info.ibltCells);
+  std::vector<Counts> counts(1);
 
-      seqan::clear(string2hash);
-      seqan::clear(idSub);
+  if (info.files > 0 && !info.debug && info.dumpHashes.empty() && info.bucketSums.empty() && info.iblt.empty()) {
+    // The files are read at the same time, the largest first
+    std::vector<uint64_t> sizes;
+    for (size_t i = 0; i < info.fastafiles.size(); i++) {
+      sizes.push_back(fileSize(info.fastafiles[i].c_str()));
     }
 
+    if (!hashJobs(FastaJob(info), sizes, info.files, info.hash, counts, count)) {
+      return 1;
+    }
+  } else {
+    for (size_t i = 0; i < info.fastafiles.size(); i++) {
+      if (!hashFasta(pipeline, info.fastafiles[i].c_str(), info, count)) {
+        return 1;
+      }
+    }
+  }
+  pipeline.finish(counts);
+  if (!dump.close()) {
+    return 1;
+  }
+  if (!info.bucketSums.empty() && !writeBucketSums(info.bucketSums.c_str(), pipeline.bucketSums(), info.hash)) {
+    return 1;
+  }
+  if (!info.iblt.empty() && !pipeline.readTable().write(info.iblt.c_str(), info.hash)) {
+    return 1;
   }
 
   if (!info.debug) {
-    std::cout << std::hex << sum << "\t";
+    std::cout << formatSum(counts[0], info.hash, info.sumBits) << "\t";
     std::cout << std::dec << count << "\n";
   }
     
   return 0;
 }
-
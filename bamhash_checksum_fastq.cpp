@@ -3,6 +3,7 @@
 #include <seqan/seq_io.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <string>
 #include <cmath>
 #include <cstdlib>
@@ -11,17 +12,8 @@
 #include <seqan/arg_parse.h>
 
 #include "bamhash_checksum_common.h"
-
-struct Fastqinfo {
-  std::vector<std::string> fastqfiles;
-  bool debug;
-  bool noReadNames;
-  bool noQuality;
-  bool paired;
-
-  Fastqinfo() : debug(false), noReadNames(false), noQuality(false), paired(true) {}
-
-};
+#include "bamhash_pipeline.h"
+#include "bamhash_fastq.h"
 
 seqan::ArgumentParser::ParseResult
 parseCommandLine(Fastqinfo& options, int argc, char const **argv) {
@@ -46,6 +38,55 @@ parseCommandLine(Fastqinfo& options, int argc, char const **argv) {
   addOption(parser, seqan::ArgParseOption("R", "no-readnames", "Do not use read names as part of checksum"));
   addOption(parser, seqan::ArgParseOption("Q", "no-quality", "Do not use read quality as part of checksum"));
   addOption(parser, seqan::ArgParseOption("P", "no-paired", "List of fastq files are not paired-end reads"));
+  addOption(parser, seqan::ArgParseOption("t", "threads", "Number of threads used to decompress gzip and BGZF input, 0 leaves it to seqan's reader.",
+                    seqan::ArgParseArgument::INTEGER, "INT"));
+  addOption(parser, seqan::ArgParseOption("", "hash-threads", "Number of threads used to hash reads, 0 hashes on the reading thread.",
+                    seqan::ArgParseArgument::INTEGER, "INT"));
+  addOption(parser, seqan::ArgParseOption("", "files", "Number of files, or pairs of files, read at the same time, largest first. "
+                    "Each is read and hashed on a thread of its own. 0 reads them one after another.",
+                    seqan::ArgParseArgument::INTEGER, "INT"));
+  addOption(parser, seqan::ArgParseOption("", "dump-hashes", "Writes the hash of every read, with its read group and mate, to a binary file, "
+                    "gzip compressed if the name ends in .gz. The files are then read one after another.",
+                    seqan::ArgParseArgument::STRING, "FILE"));
+  addOption(parser, seqan::ArgParseOption("", "dump-buckets", "Only writes the reads in the buckets listed in a file to --dump-hashes, "
+                    "such as the output of diff on two --bucket-sums files of the same --bucket-bits and --hash.",
+                    seqan::ArgParseArgument::STRING, "FILE"));
+  addOption(parser, seqan::ArgParseOption("", "bucket-sums", "Writes the sums of the hashes in buckets, by the first bits of the hash, to a text file. "
+                    "The files of two sets of reads differ in the buckets of the reads that differ. The files are then read one after another.",
+                    seqan::ArgParseArgument::STRING, "FILE"));
+  addOption(parser, seqan::ArgParseOption("", "bucket-bits", "Bits of the buckets of --bucket-sums and --dump-buckets.",
+                    seqan::ArgParseArgument::STRING, "BITS"));
+  addOption(parser, seqan::ArgParseOption("", "iblt", "Writes an invertible Bloom lookup table of the hashes of the reads to a small binary file. "
+                    "bamhash_diff recovers the reads that differ from the tables of two sets of reads, if there are not too many. "
+                    "The files are then read one after another.",
+                    seqan::ArgParseArgument::STRING, "FILE"));
+  addOption(parser, seqan::ArgParseOption("", "iblt-cells", "Cells of the --iblt table, 32 bytes each. Tables of the same size can be compared, "
+                    "for up to about two thirds as many differing reads.",
+                    seqan::ArgParseArgument::INTEGER, "INT"));
+  addOption(parser, seqan::ArgParseOption("", "cache", "Keeps the sums of every input file in a sidecar next to it, FILE.bamhash, "
+                    "and uses them instead of reading the file again while its size, time, inode and first and last 64KB are the same. "
+                    "A change in the middle of a file that keeps all of those is not noticed."));
+  addOption(parser, seqan::ArgParseOption("", "recompute", "Reads all files again with --cache and rewrites their sidecars."));
+  addOption(parser, seqan::ArgParseOption("", "hash", "Hash function of the reads. Sums of different functions can not be compared, "
+                    "so other functions than md5 print their name in front of the sum.",
+                    seqan::ArgParseArgument::STRING, "NAME"));
+  addOption(parser, seqan::ArgParseOption("", "sum-bits", "Width of the sum of the hashes. 128 bit sums are printed with the hash function and /128 in front.",
+                    seqan::ArgParseArgument::STRING, "BITS"));
+
+  setMinValue(parser, "threads", "0");
+  setDefaultValue(parser, "threads", 0);
+  setMinValue(parser, "hash-threads", "0");
+  setDefaultValue(parser, "hash-threads", 0);
+  setMinValue(parser, "files", "0");
+  setDefaultValue(parser, "files", 0);
+  setValidValues(parser, "hash", BAMHASH_HASH_FUNCTIONS);
+  setDefaultValue(parser, "hash", "md5");
+  setValidValues(parser, "sum-bits", "64 128");
+  setDefaultValue(parser, "sum-bits", "64");
+  setValidValues(parser, "bucket-bits", "4 8 12 16 20");
+  setDefaultValue(parser, "bucket-bits", "16");
+  setMinValue(parser, "iblt-cells", "3");
+  setDefaultValue(parser, "iblt-cells", BAMHASH_IBLT_CELLS);
 
   // Parse command line.
   seqan::ArgumentParser::ParseResult res = seqan::parse(parser, argc, argv);
@@ -57,6 +98,25 @@ parseCommandLine(Fastqinfo& options, int argc, char const **argv) {
   options.noReadNames = seqan::isSet(parser, "no-readnames");
   options.noQuality = seqan::isSet(parser, "no-quality");
   options.paired = !seqan::isSet(parser, "no-paired");
+  seqan::getOptionValue(options.threads, parser, "threads");
+  seqan::getOptionValue(options.hashThreads, parser, "hash-threads");
+  seqan::getOptionValue(options.files, parser, "files");
+  seqan::getOptionValue(options.dumpHashes, parser, "dump-hashes");
+  seqan::getOptionValue(options.dumpBuckets, parser, "dump-buckets");
+  seqan::getOptionValue(options.bucketSums, parser, "bucket-sums");
+  std::string bucketBits;
+  seqan::getOptionValue(bucketBits, parser, "bucket-bits");
+  options.bucketBits = atoi(bucketBits.c_str());
+  seqan::getOptionValue(options.iblt, parser, "iblt");
+  seqan::getOptionValue(options.ibltCells, parser, "iblt-cells");
+  options.recompute = seqan::isSet(parser, "recompute");
+  options.cache = options.recompute || seqan::isSet(parser, "cache");
+  std::string hash;
+  seqan::getOptionValue(hash, parser, "hash");
+  parseHashFunction(hash, options.hash);
+  std::string sumBits;
+  seqan::getOptionValue(sumBits, parser, "sum-bits");
+  options.sumBits = atoi(sumBits.c_str());
 
   options.fastqfiles = getArgumentValues(parser, 0);
 
@@ -64,7 +124,6 @@ parseCommandLine(Fastqinfo& options, int argc, char const **argv) {
   return seqan::ArgumentParser::PARSE_OK;
 }
 
-
 int main(int argc, char const **argv) {
   Fastqinfo info; // Define structure variable
   seqan::ArgumentParser::ParseResult res = parseCommandLine(info, argc, argv); // Parse the command line.
@@ -73,165 +132,12 @@ int main(int argc, char const **argv) {
     return res == seqan::ArgumentParser::PARSE_ERROR;
   }
 
-  // Define:
-  uint64_t sum = 0;
   unsigned count = 0;
-  seqan::StringSet<seqan::CharString> idSub1;
-  seqan::StringSet<seqan::CharString> idSub2;
-  seqan::CharString string2hash1;
-  seqan::CharString string2hash2;
-  seqan::CharString id1;
-  seqan::CharString id2;
-  seqan::CharString seq1;
-  seqan::CharString seq2;
-  seqan::CharString qual1;
-  seqan::CharString qual2;
-  hash_t hex1;
-  hash_t hex2;
-
-
-  // Open Files
-  seqan::SeqFileIn seqFileIn1;
-  seqan::SeqFileIn seqFileIn2;
-
-  if (info.paired && (info.fastqfiles.size() % 2 != 0)) {
-    std::cerr << "ERROR: Running with paired end mode, but supplied an odd number of input files ";
-    for (int i = 0; i < info.fastqfiles.size(); i++) {
-      std::cerr << info.fastqfiles[i] << " ";
-    }
-    std::cerr << std::endl;
+  Counts sum;
+  if (!hashFastqFiles(info, sum, count)) {
     return 1;
   }
 
-  for (int i = 0; i < info.fastqfiles.size(); i += (info.paired) ? 2 : 1) {
-    const char* fastq1 = info.fastqfiles[i].c_str();
-    const char* fastq2 = "";
-    if (info.paired) {
-     fastq2 = info.fastqfiles[i+1].c_str();
-    }
-
-
-    if (!open(seqFileIn1, fastq1))
-    {
-        std::cerr << "ERROR: Could not open the file: " << fastq1 << " for reading.\n";
-        return 1;
-    }
-
-    if (info.paired) {
-        if (!open(seqFileIn2, fastq2))
-        {
-            std::cerr << "ERROR: Could not open the file: " << fastq2 << " for reading.\n";
-            return 1;
-        }
-    }
-
-/*
-    StringSet<Dna5String> seqs;
-*/
-
-    // Read record
-    while (!atEnd(seqFileIn1)) {
-      if(info.paired)
-      {
-        if(atEnd(seqFileIn2)) { break; }
-      }
-      try
-      {
-          seqan::readRecord(id1, seq1, qual1, seqFileIn1);
-      }
-      catch (seqan::Exception const & e)
-      {
-        if (atEnd(seqFileIn1))
-        {
-          std::cerr << "WARNING: Could not continue reading " << fastq1 <<  " at line: " << count+1 << ". Check if files have the same number of reads.\n";
-          return 1;
-        }
-        std::cerr << "ERROR: Could not read from " << fastq1 << "\n";
-        return 1;
-      }
-
-      try
-      {
-        if (info.paired)
-        {
-            seqan::readRecord(id2, seq2, qual2, seqFileIn2);
-        }
-      }
-      catch (seqan::Exception const & e)
-      {
-        if (atEnd(seqFileIn2))
-        {
-          std::cerr << "WARNING: Could not continue reading " << fastq2 << " at line: " << count+1 << ". Check if files have the same number of reads.\n";
-          return 1;
-        }
-        std::cerr << "ERROR: Could not read from " << fastq2 << "\n";
-        return 1;
-      }
-
-      count +=1;
-
-
-      // If include id, then cut id on first whitespace
-      if (seqan::endsWith(id1,"/1") || seqan::endsWith(id1,"/2")) {
-        seqan::strSplit(idSub1, id1, seqan::EqualsChar<'/'>(), false, 1);
-      } else {
-        seqan::strSplit(idSub1, id1, seqan::EqualsChar<' '>(), false, 1);
-      }
-
-      if (info.paired) {
-        if (seqan::endsWith(id2,"/1") || seqan::endsWith(id2,"/2")) {
-          seqan::strSplit(idSub2, id2, seqan::EqualsChar<'/'>(), false, 1);
-        } else {
-          seqan::strSplit(idSub2, id2, seqan::EqualsChar<' '>(), false, 1);
-        }
-      }
-
-      // Check if names are in same order in both files
-      if (info.paired && !info.noReadNames && !(idSub1[0] ==  idSub2[0])) {
-        std::cerr << "WARNING: Id_names in line: " << count << " are not in the same order\n";
-        return 1;
-      }
-
-      if (!info.noReadNames) {
-        seqan::append(string2hash1, idSub1[0]);
-        seqan::append(string2hash1,"/1");
-      }
-      seqan::append(string2hash1, seq1);
-      if (!info.noQuality) {
-        seqan::append(string2hash1, qual1);
-      }
-
-      if (info.paired) {
-        if (!info.noReadNames) {
-          seqan::append(string2hash2, idSub2[0]);
-          seqan::append(string2hash2,"/2");
-        }
-        seqan::append(string2hash2, seq2);
-        if (!info.noQuality) {
-          seqan::append(string2hash2, qual2);
-        }
-      }
-
-      // Get MD5 hash
-      hex1 = str2md5(toCString(string2hash1), length(string2hash1));
-      if(info.paired) { hex2 = str2md5(toCString(string2hash2), length(string2hash2)); }
-
-      if (info.debug) {
-        std::cout << string2hash1 << " " <<   std::hex << hex1.p.low << "\n";
-        if(info.paired) { std::cout << string2hash2 << std::hex << hex2.p.low << "\n"; }
-      } else {
-        hexSum(hex1, sum);
-        if(info.paired) { hexSum(hex2, sum); }
-      }
-
-      seqan::clear(string2hash1);
-      seqan::clear(string2hash2);
-      seqan::clear(idSub1);
-      seqan::clear(idSub2);
-
-    }
-
-  }
   if (!info.debug && count == 0)
   {
     std::cerr << "WARNING: Read count is : " << count << "\n";
@@ -239,11 +145,10 @@ int main(int argc, char const **argv) {
   }
 
   if (!info.debug) {
-    std::cout << std::hex << sum << "\t";
+    std::cout << formatSum(sum, info.hash, info.sumBits) << "\t";
     std::cout << std::dec << count << "\n";
   }
 
     
   return 0;
 }
-
@@ -0,0 +1,163 @@
+#include <iostream>
+#include <map>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <seqan/arg_parse.h>
+#include <seqan/parallel.h>
+
+#include "bamhash_checksum_common.h"
+#include "bamhash_bam.h"
+#include "bamhash_fastq.h"
+
+// Whether the file is read as SAM, BAM or CRAM, all other files are FASTQ.
+bool isBamFile(std::string const & file) {
+  const char * extensions[] = {".sam", ".bam", ".cram"};
+  for (int i = 0; i < 3; i++) {
+    size_t length = strlen(extensions[i]);
+    if (file.size() >= length && file.compare(file.size() - length, length, extensions[i]) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+seqan::ArgumentParser::ParseResult
+parseCommandLine(Fastqinfo & fastqOptions, Baminfo & bamOptions, int argc, char const **argv) {
+  // Setup ArgumentParser.
+  seqan::ArgumentParser parser("bamhash_compare");
+
+  setShortDescription(parser, "Compares the reads of a set of fastq files to those of sam, bam or cram files");
+  setVersion(parser, BAMHASH_VERSION);
+  setDate(parser, "Oct 2026");
+
+  addUsageLine(parser, "[\\fIOPTIONS\\fP] \\fI<in1.fastq.gz> <in2.fastq.gz> ... <in.bam> ...\\fP");
+  addDescription(parser, "Program that checks that the sequence reads of the fastq files are those of the sam, bam and cram files. "
+                 "Both sides are hashed at the same time. Exits with failure if the sums or the numbers of reads differ.");
+
+  addArgument(parser, seqan::ArgParseArgument(seqan::ArgParseArgument::INPUT_FILE, "files", true));
+  setValidValues(parser, 0, "fq fq.gz fastq fastq.gz sam bam cram");
+
+  addSection(parser, "Options");
+  addOption(parser, seqan::ArgParseOption("R", "no-readnames", "Do not use read names as part of checksum"));
+  addOption(parser, seqan::ArgParseOption("Q", "no-quality", "Do not use read quality as part of checksum"));
+  addOption(parser, seqan::ArgParseOption("P", "no-paired", "List of fastq files are not paired-end reads, and bam files were not generated with paired-end reads"));
+  addOption(parser, seqan::ArgParseOption("r", "reference-file", "Path to reference-file if reference not given in header",
+                    seqan::ArgParseArgument::INPUT_FILE));
+  addOption(parser, seqan::ArgParseOption("t", "threads", "Number of threads used to decompress the input of each side, 0 decompresses on the reading threads.",
+                    seqan::ArgParseArgument::INTEGER, "INT"));
+  addOption(parser, seqan::ArgParseOption("", "hash-threads", "Number of threads used to hash the reads of each side, 0 hashes on the reading threads.",
+                    seqan::ArgParseArgument::INTEGER, "INT"));
+  addOption(parser, seqan::ArgParseOption("", "hash", "Hash function of the reads.",
+                    seqan::ArgParseArgument::STRING, "NAME"));
+  addOption(parser, seqan::ArgParseOption("", "sum-bits", "Width of the printed sums. The full 128 bit sums are always compared.",
+                    seqan::ArgParseArgument::STRING, "BITS"));
+
+  setValidValues(parser, "reference-file", "fa");
+  setMinValue(parser, "threads", "0");
+  setDefaultValue(parser, "threads", 0);
+  setMinValue(parser, "hash-threads", "0");
+  setDefaultValue(parser, "hash-threads", 0);
+  setValidValues(parser, "hash", BAMHASH_HASH_FUNCTIONS);
+  setDefaultValue(parser, "hash", "md5");
+  setValidValues(parser, "sum-bits", "64 128");
+  setDefaultValue(parser, "sum-bits", "64");
+
+  // Parse command line.
+  seqan::ArgumentParser::ParseResult res = seqan::parse(parser, argc, argv);
+  if (res != seqan::ArgumentParser::PARSE_OK) {
+    return res;
+  }
+
+  fastqOptions.noReadNames = bamOptions.noReadNames = isSet(parser, "no-readnames");
+  fastqOptions.noQuality = bamOptions.noQuality = isSet(parser, "no-quality");
+  fastqOptions.paired = bamOptions.paired = !isSet(parser, "no-paired");
+  getOptionValue(bamOptions.reference, parser, "reference-file");
+  getOptionValue(fastqOptions.threads, parser, "threads");
+  bamOptions.threads = fastqOptions.threads;
+  getOptionValue(fastqOptions.hashThreads, parser, "hash-threads");
+  bamOptions.hashThreads = fastqOptions.hashThreads;
+  std::string hash;
+  getOptionValue(hash, parser, "hash");
+  parseHashFunction(hash, fastqOptions.hash);
+  bamOptions.hash = fastqOptions.hash;
+  std::string sumBits;
+  getOptionValue(sumBits, parser, "sum-bits");
+  fastqOptions.sumBits = bamOptions.sumBits = atoi(sumBits.c_str());
+
+  std::vector<std::string> files = getArgumentValues(parser, 0);
+  for (size_t i = 0; i < files.size(); i++) {
+    if (isBamFile(files[i])) {
+      bamOptions.bamfiles.push_back(files[i]);
+    } else {
+      fastqOptions.fastqfiles.push_back(files[i]);
+    }
+  }
+
+  return seqan::ArgumentParser::PARSE_OK;
+}
+
+// -----------------------------------------------------------------------------
+// CLASS BamThread
+// -----------------------------------------------------------------------------
+
+// Hashes the BAM side while the main thread hashes the FASTQ files.
+
+struct BamThread
+{
+  Baminfo const * info;
+  Counts sum; // of all read groups
+  bool ok;
+
+  void operator()()
+  {
+    std::map<seqan::CharString, unsigned> laneNames;
+    std::vector<Counts> counts;
+    // the sum of all reads, also of read groups in the headers of several files
+    ok = hashBamFiles(*info, laneNames, counts, &sum);
+  }
+};
+
+int main(int argc, char const **argv) {
+  Fastqinfo fastqInfo;
+  Baminfo bamInfo;
+  seqan::ArgumentParser::ParseResult res = parseCommandLine(fastqInfo, bamInfo, argc, argv); // Parse the command line.
+
+  if (res != seqan::ArgumentParser::PARSE_OK) {
+    return res == seqan::ArgumentParser::PARSE_ERROR;
+  }
+
+  if (fastqInfo.fastqfiles.empty() || bamInfo.bamfiles.empty()) {
+    std::cerr << "ERROR: Give both fastq files and sam, bam or cram files to compare\n";
+    return 1;
+  }
+
+  seqan::Thread<BamThread> bamThread;
+  bamThread.worker.info = &bamInfo;
+  bamThread.worker.ok = false;
+  run(bamThread);
+
+  unsigned count = 0;
+  Counts fastqSum;
+  bool ok = hashFastqFiles(fastqInfo, fastqSum, count);
+
+  waitFor(bamThread);
+  if (!ok || !bamThread.worker.ok) {
+    return 1;
+  }
+
+  // The reads of both sides, every mate counts
+  Counts const & bamSum = bamThread.worker.sum;
+  std::cout << "fastq\t" << formatSum(fastqSum, fastqInfo.hash, fastqInfo.sumBits) << "\t";
+  std::cout << std::dec << fastqSum.count << "\n";
+  std::cout << "bam\t" << formatSum(bamSum, bamInfo.hash, bamInfo.sumBits) << "\t";
+  std::cout << std::dec << bamSum.count << "\n";
+
+  if (fastqSum.sum != bamSum.sum || fastqSum.sumHigh != bamSum.sumHigh || fastqSum.count != bamSum.count) {
+    std::cerr << "ERROR: The reads of the fastq files and the sam, bam or cram files differ\n";
+    return 1;
+  }
+
+  return 0;
+}
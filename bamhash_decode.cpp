@@ -0,0 +1,65 @@
+#include <stdint.h>
+
+#include "bamhash_decode.h"
+
+char const BAM_SEQ_DECODE[17] = "UACMGRSVTWYHKDBN";
+char const BAM_SEQ_DECODE_COMPLEMENT[17] = "UTGKCYSBAWRDMHVN";
+
+// base i of a packed sequence, as bam_seqi()
+static inline int baseAt(const uint8_t *seq, int32_t i) {
+  return (seq[i >> 1] >> ((~i & 1) << 2)) & 0xf;
+}
+
+void decodeBases(char *out, const uint8_t *seq, int32_t from, int32_t n) {
+  static const bool avx2 = decodeAvx2Supported();
+  int32_t i = 0;
+
+  if (avx2) {
+    if ((from & 1) && n > 0) {
+      out[i] = BAM_SEQ_DECODE[baseAt(seq, from + i)];
+      ++i;
+    }
+    i += decodeBasesAvx2(out + i, seq, from + i, n - i);
+  }
+
+  for (; i < n; ++i) {
+    out[i] = BAM_SEQ_DECODE[baseAt(seq, from + i)];
+  }
+}
+
+void decodeBasesReverse(char *out, const uint8_t *seq, int32_t end, int32_t n) {
+  static const bool avx2 = decodeAvx2Supported();
+  int32_t i = 0;
+
+  if (avx2) {
+    if ((end & 1) && n > 0) {
+      out[i] = BAM_SEQ_DECODE_COMPLEMENT[baseAt(seq, end - 1 - i)];
+      ++i;
+    }
+    i += decodeBasesReverseAvx2(out + i, seq, end - i, n - i);
+  }
+
+  for (; i < n; ++i) {
+    out[i] = BAM_SEQ_DECODE_COMPLEMENT[baseAt(seq, end - 1 - i)];
+  }
+}
+
+void decodeQuals(char *out, const uint8_t *qual, int32_t from, int32_t n) {
+  // simple enough for the compiler to vectorize
+  for (int32_t i = 0; i < n; ++i) {
+    out[i] = static_cast<char>(qual[from + i] + 33);
+  }
+}
+
+void decodeQualsReverse(char *out, const uint8_t *qual, int32_t end, int32_t n) {
+  static const bool avx2 = decodeAvx2Supported();
+  int32_t i = 0;
+
+  if (avx2) {
+    i = decodeQualsReverseAvx2(out, qual, end, n);
+  }
+
+  for (; i < n; ++i) {
+    out[i] = static_cast<char>(qual[end - 1 - i] + 33);
+  }
+}
@@ -0,0 +1,43 @@
+#ifndef BAMHASH_DECODE_H
+#define BAMHASH_DECODE_H
+
+#include <stdint.h>
+
+// Decoding of the 4 bit bases and the quality values of BAM records into the
+// text that is hashed. Reads on the reverse strand are turned back to their
+// sequenced orientation while they are decoded. The bulk of a read goes
+// through an AVX2 kernel when the CPU has one, the rest one base at a time.
+
+// Both tables match seqan's Iupac alphabet, which the hashed strings have
+// always gone through ('=' is written as 'U').
+extern char const BAM_SEQ_DECODE[17];
+extern char const BAM_SEQ_DECODE_COMPLEMENT[17];
+
+// out[i] = base from + i of the packed sequence seq.
+void decodeBases(char *out, const uint8_t *seq, int32_t from, int32_t n);
+
+// out[i] = complement of base end - 1 - i, the reverse complement of the bases
+// [end - n, end).
+void decodeBasesReverse(char *out, const uint8_t *seq, int32_t end, int32_t n);
+
+// out[i] = qual[from + i] + 33.
+void decodeQuals(char *out, const uint8_t *qual, int32_t from, int32_t n);
+
+// out[i] = qual[end - 1 - i] + 33.
+void decodeQualsReverse(char *out, const uint8_t *qual, int32_t end, int32_t n);
+
+
+// -----------------------------------------------------------------------------
+// AVX2 kernels (bamhash_decode_avx2.cpp). They decode as many whole blocks of
+// 64 bases or 32 quality values as fit in n and return how many they did.
+// For the bases from and end must be even, so blocks start on a byte.
+// -----------------------------------------------------------------------------
+
+// True when the kernels were compiled in and the running CPU supports them.
+bool decodeAvx2Supported();
+
+int32_t decodeBasesAvx2(char *out, const uint8_t *seq, int32_t from, int32_t n);
+int32_t decodeBasesReverseAvx2(char *out, const uint8_t *seq, int32_t end, int32_t n);
+int32_t decodeQualsReverseAvx2(char *out, const uint8_t *qual, int32_t end, int32_t n);
+
+#endif // BAMHASH_DECODE_H
@@ -0,0 +1,92 @@
+// AVX2 kernels of the BAM base and quality decoding, 64 bases or 32 quality
+// values per step. This file is compiled with -mavx2; decodeAvx2Supported()
+// gates its use at runtime.
+
+#include "bamhash_decode.h"
+
+#ifdef __AVX2__
+
+#include <immintrin.h>
+
+bool decodeAvx2Supported() {
+  return __builtin_cpu_supports("avx2");
+}
+
+// The 64 bases in the 32 bytes at p, looked up in table: bases 0-31 in first,
+// 32-63 in second. The first base of a byte is its high nibble.
+static inline void decode64(const uint8_t *p, __m256i table, __m256i & first, __m256i & second) {
+  const __m256i mask = _mm256_set1_epi8(0x0f);
+  __m256i packed = _mm256_loadu_si256((const __m256i *)p);
+  __m256i high = _mm256_and_si256(_mm256_srli_epi16(packed, 4), mask);
+  __m256i low = _mm256_and_si256(packed, mask);
+  // unpack works within 128 bit lanes: bytes 0-7 and 16-23, then 8-15 and 24-31
+  __m256i u0 = _mm256_unpacklo_epi8(high, low);
+  __m256i u1 = _mm256_unpackhi_epi8(high, low);
+  first = _mm256_shuffle_epi8(table, _mm256_permute2x128_si256(u0, u1, 0x20));
+  second = _mm256_shuffle_epi8(table, _mm256_permute2x128_si256(u0, u1, 0x31));
+}
+
+static inline __m256i reverse32(__m256i x) {
+  const __m256i reverseLanes = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                                                15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+  return _mm256_permute4x64_epi64(_mm256_shuffle_epi8(x, reverseLanes), 0x4e);
+}
+
+static inline __m256i loadTable(const char *table) {
+  return _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)table));
+}
+
+int32_t decodeBasesAvx2(char *out, const uint8_t *seq, int32_t from, int32_t n) {
+  const __m256i table = loadTable(BAM_SEQ_DECODE);
+  int32_t i = 0;
+  for (; i + 64 <= n; i += 64) {
+    __m256i first, second;
+    decode64(seq + (from + i) / 2, table, first, second);
+    _mm256_storeu_si256((__m256i *)(out + i), first);
+    _mm256_storeu_si256((__m256i *)(out + i + 32), second);
+  }
+  return i;
+}
+
+int32_t decodeBasesReverseAvx2(char *out, const uint8_t *seq, int32_t end, int32_t n) {
+  const __m256i table = loadTable(BAM_SEQ_DECODE_COMPLEMENT);
+  int32_t i = 0;
+  for (; i + 64 <= n; i += 64) {
+    __m256i first, second;
+    decode64(seq + (end - i - 64) / 2, table, first, second);
+    _mm256_storeu_si256((__m256i *)(out + i), reverse32(second));
+    _mm256_storeu_si256((__m256i *)(out + i + 32), reverse32(first));
+  }
+  return i;
+}
+
+int32_t decodeQualsReverseAvx2(char *out, const uint8_t *qual, int32_t end, int32_t n) {
+  const __m256i offset = _mm256_set1_epi8(33);
+  int32_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i q = _mm256_loadu_si256((const __m256i *)(qual + end - i - 32));
+    _mm256_storeu_si256((__m256i *)(out + i), reverse32(_mm256_add_epi8(q, offset)));
+  }
+  return i;
+}
+
+#else
+
+// Built without -mavx2: the kernels are never selected.
+bool decodeAvx2Supported() {
+  return false;
+}
+
+int32_t decodeBasesAvx2(char *, const uint8_t *, int32_t, int32_t) {
+  return 0;
+}
+
+int32_t decodeBasesReverseAvx2(char *, const uint8_t *, int32_t, int32_t) {
+  return 0;
+}
+
+int32_t decodeQualsReverseAvx2(char *, const uint8_t *, int32_t, int32_t) {
+  return 0;
+}
+
+#endif
@@ -0,0 +1,539 @@
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include <zlib.h>
+#include <seqan/arg_parse.h>
+
+#include "bamhash_checksum_common.h"
+#include "bamhash_dump.h"
+#include "bamhash_iblt.h"
+#include "bamhash_pipeline.h"
+
+// Buckets are the files of one side, cut by the top bits of the hash. More
+// than 2^BAMHASH_DIFF_PASS_BITS at once would take more open files than a
+// process usually has, the dumps are then read once for every pass of those.
+#define BAMHASH_DIFF_PASS_BITS 8
+#define BAMHASH_DIFF_MAX_BITS 24
+
+// Records read from a dump at once.
+#define BAMHASH_DIFF_CHUNK 65536
+
+struct Diffinfo {
+  std::string dumps[2];
+  int memory; // MB
+  int threads;
+  std::string tmpDir;
+
+  Diffinfo() : memory(1024), threads(1), tmpDir("/tmp") {}
+
+};
+
+seqan::ArgumentParser::ParseResult
+parseCommandLine(Diffinfo& options, int argc, char const **argv) {
+  // Setup ArgumentParser.
+  seqan::ArgumentParser parser("bamhash_diff");
+
+  setShortDescription(parser, "Reads that are in only one of two hash dumps");
+  setVersion(parser, BAMHASH_VERSION);
+  setDate(parser, "Oct 2026");
+
+  addUsageLine(parser, "[\\fIOPTIONS\\fP] \\fI<dump1> <dump2>\\fP");
+  addDescription(parser, "Program that compares the hashes of the reads written with --dump-hashes by two runs of the checksum programs. "
+                 "Prints the reads that are only in the first dump, marked <, and those only in the second, marked >, "
+                 "with their hash, read group and mate. Exits with failure if there are any. "
+                 "Given two tables written with --iblt instead, recovers the hashes of the reads that differ from those, "
+                 "without their read group and mate.");
+
+  addArgument(parser, seqan::ArgParseArgument(seqan::ArgParseArgument::INPUT_FILE, "dump1"));
+  addArgument(parser, seqan::ArgParseArgument(seqan::ArgParseArgument::INPUT_FILE, "dump2"));
+
+  addSection(parser, "Options");
+  addOption(parser, seqan::ArgParseOption("m", "memory", "Megabytes of hashes held in memory at once. Larger dumps are split into buckets on disk first, "
+                    "and fewer threads are used when the largest buckets don't fit.",
+                    seqan::ArgParseArgument::INTEGER, "MB"));
+  addOption(parser, seqan::ArgParseOption("t", "threads", "Number of threads that sort and compare the buckets.",
+                    seqan::ArgParseArgument::INTEGER, "INT"));
+  addOption(parser, seqan::ArgParseOption("", "tmp-dir", "Directory of the buckets.",
+                    seqan::ArgParseArgument::STRING, "DIR"));
+
+  setMinValue(parser, "memory", "1");
+  setDefaultValue(parser, "memory", 1024);
+  setMinValue(parser, "threads", "1");
+  setDefaultValue(parser, "threads", 1);
+  setDefaultValue(parser, "tmp-dir", "/tmp");
+
+  // Parse command line.
+  seqan::ArgumentParser::ParseResult res = seqan::parse(parser, argc, argv);
+  if (res != seqan::ArgumentParser::PARSE_OK) {
+    return res;
+  }
+
+  getArgumentValue(options.dumps[0], parser, 0);
+  getArgumentValue(options.dumps[1], parser, 1);
+  getOptionValue(options.memory, parser, "memory");
+  getOptionValue(options.threads, parser, "threads");
+  getOptionValue(options.tmpDir, parser, "tmp-dir");
+
+  return seqan::ArgumentParser::PARSE_OK;
+}
+
+// Orders records by their hash, the read group and mate don't count.
+static inline bool lessHash(DumpRecord const & a, DumpRecord const & b) {
+  return a.high < b.high || (a.high == b.high && a.low < b.low);
+}
+
+// -----------------------------------------------------------------------------
+// CLASS DumpSide
+// -----------------------------------------------------------------------------
+
+// One of the two dumps. With bits > 0 its records are first split into 2^bits
+// buckets by the top bits of the hash, each an unlinked temporary file, a pass
+// of them at a time. With bits == 0 the whole dump is the only bucket and is
+// read straight from the dump file.
+
+class DumpSide
+{
+  public:
+  DumpSide() : gz(NULL), numRecords(0) {}
+  ~DumpSide();
+
+  // Opens the dump and checks its header. Returns false on an error, after
+  // printing it.
+  bool open(const char * fileName, DumpHeader & header);
+
+  // Reads the dump into the count buckets from first on, those of the pass
+  // before are dropped.
+  bool split(unsigned bits, unsigned first, unsigned count, std::string const & tmpDir);
+
+  // The records of bucket b of the pass. Returns false on an error, after
+  // printing it.
+  bool load(unsigned b, std::vector<DumpRecord> & records);
+
+  // Bytes in bucket b of the pass.
+  uint64_t bucketSize(unsigned b) const {
+    return buckets.empty() ? numRecords * sizeof(DumpRecord) : bucketBytes[b];
+  }
+
+  private:
+  // Reads up to n records, returns how many or -1 on an error.
+  long read(DumpRecord * records, size_t n);
+  // Starts reading the records again.
+  bool rewind();
+  void closeBuckets();
+
+  std::string fileName;
+  gzFile gz;
+  uint64_t numRecords;
+  std::vector<FILE *> buckets;
+  std::vector<uint64_t> bucketBytes;
+};
+
+DumpSide::~DumpSide() {
+  if (gz != NULL) {
+    gzclose(gz);
+  }
+  closeBuckets();
+}
+
+void DumpSide::closeBuckets() {
+  for (size_t b = 0; b < buckets.size(); b++) {
+    fclose(buckets[b]);
+  }
+  buckets.clear();
+  bucketBytes.clear();
+}
+
+bool DumpSide::open(const char * fileName_, DumpHeader & header) {
+  fileName = fileName_;
+  // reads gzip compressed and uncompressed files alike
+  gz = gzopen(fileName_, "rb");
+  if (gz == NULL) {
+    std::cerr << "ERROR: Could not open the file: " << fileName << " for reading.\n";
+    return false;
+  }
+  gzbuffer(gz, 1 << 20);
+
+  if (gzread(gz, &header, sizeof(header)) != (int)sizeof(header) ||
+      memcmp(header.magic, BAMHASH_DUMP_MAGIC, sizeof(header.magic)) != 0) {
+    std::cerr << "ERROR: " << fileName << " is not a hash dump written with --dump-hashes\n";
+    return false;
+  }
+  if (header.recordSize != sizeof(DumpRecord)) {
+    std::cerr << "ERROR: " << fileName << " has records of " << header.recordSize << " bytes, not " << sizeof(DumpRecord) << "\n";
+    return false;
+  }
+  if (header.records == BAMHASH_DUMP_UNFINISHED) {
+    std::cerr << "ERROR: " << fileName << " was not written to the end\n";
+    return false;
+  }
+  numRecords = header.records;
+  return true;
+}
+
+bool DumpSide::rewind() {
+  DumpHeader header;
+  if (gzrewind(gz) != 0 || gzread(gz, &header, sizeof(header)) != (int)sizeof(header)) {
+    std::cerr << "ERROR: Could not read from " << fileName << "\n";
+    return false;
+  }
+  return true;
+}
+
+long DumpSide::read(DumpRecord * records, size_t n) {
+  int bytes = gzread(gz, records, n * sizeof(DumpRecord));
+  if (bytes < 0 || bytes % sizeof(DumpRecord) != 0) {
+    std::cerr << "ERROR: Could not read from " << fileName << "\n";
+    return -1;
+  }
+  return bytes / sizeof(DumpRecord);
+}
+
+bool DumpSide::split(unsigned bits, unsigned first, unsigned count, std::string const & tmpDir) {
+  if (bits == 0) {
+    return true;
+  }
+  if (first > 0 && !rewind()) {
+    return false;
+  }
+
+  closeBuckets();
+  buckets.resize(count);
+  bucketBytes.resize(count);
+  for (size_t b = 0; b < buckets.size(); b++) {
+    std::string name = tmpDir + "/bamhash_diff.XXXXXX";
+    int fd = mkstemp(&name[0]);
+    if (fd < 0 || (buckets[b] = fdopen(fd, "w+b")) == NULL) {
+      std::cerr << "ERROR: Could not create a temporary file in " << tmpDir << "\n";
+      buckets.resize(b);
+      return false;
+    }
+    // removed once it is closed
+    unlink(name.c_str());
+  }
+
+  std::vector<DumpRecord> chunk(BAMHASH_DIFF_CHUNK);
+  long n;
+  while ((n = read(&chunk[0], chunk.size())) > 0) {
+    for (long i = 0; i < n; i++) {
+      unsigned b = chunk[i].high >> (64 - bits);
+      if (b < first || b >= first + count) {
+        continue;
+      }
+      b -= first;
+      if (fwrite(&chunk[i], sizeof(DumpRecord), 1, buckets[b]) != 1) {
+        std::cerr << "ERROR: Could not write to a temporary file in " << tmpDir << "\n";
+        return false;
+      }
+      bucketBytes[b] += sizeof(DumpRecord);
+    }
+  }
+  return n == 0;
+}
+
+bool DumpSide::load(unsigned b, std::vector<DumpRecord> & records) {
+  records.clear();
+  if (buckets.empty()) {
+    records.reserve(numRecords);
+    std::vector<DumpRecord> chunk(BAMHASH_DIFF_CHUNK);
+    long n;
+    while ((n = read(&chunk[0], chunk.size())) > 0) {
+      records.insert(records.end(), chunk.begin(), chunk.begin() + n);
+    }
+    return n == 0;
+  }
+
+  records.resize(bucketBytes[b] / sizeof(DumpRecord));
+  if (fflush(buckets[b]) != 0 || fseeko(buckets[b], 0, SEEK_SET) != 0 ||
+      (!records.empty() && fread(&records[0], sizeof(DumpRecord), records.size(), buckets[b]) != records.size())) {
+    std::cerr << "ERROR: Could not read back a temporary file of " << fileName << "\n";
+    return false;
+  }
+  return true;
+}
+
+// -----------------------------------------------------------------------------
+// CLASS HashDiff
+// -----------------------------------------------------------------------------
+
+// Sorts and compares the buckets of both sides on several threads, largest
+// first. The lines of every bucket are printed in bucket order, so the output
+// is sorted by hash. A hash that is n times in one dump and m times in the
+// other is printed |n - m| times.
+
+class HashDiff
+{
+  public:
+  struct DiffThread
+  {
+    HashDiff * diff;
+    bool ok;
+
+    void operator()();
+  };
+
+  HashDiff(DumpSide * sides_, unsigned numBuckets);
+
+  bool run(unsigned numThreads);
+
+  uint64_t only[2]; // reads in one dump only
+
+  private:
+  // Compares bucket b and stores its lines.
+  bool compare(unsigned b, std::vector<DumpRecord> * records);
+  // Prints the buckets that are done, in order.
+  void print(unsigned b, std::string & lines, uint64_t const * bucketOnly);
+
+  DumpSide * sides;
+  WorkQueue queue;
+  std::vector<std::string> lines;
+  std::vector<char> done;
+  unsigned nextPrint;
+  seqan::Mutex lock;
+};
+
+// The sizes of the buckets of both sides, the queue takes the largest first.
+static std::vector<uint64_t> bucketSizes(DumpSide const * sides, unsigned numBuckets) {
+  std::vector<uint64_t> sizes(numBuckets);
+  for (unsigned b = 0; b < numBuckets; b++) {
+    sizes[b] = sides[0].bucketSize(b) + sides[1].bucketSize(b);
+  }
+  return sizes;
+}
+
+HashDiff::HashDiff(DumpSide * sides_, unsigned numBuckets) :
+  sides(sides_),
+  queue(bucketSizes(sides_, numBuckets)),
+  lines(numBuckets),
+  done(numBuckets),
+  nextPrint(0),
+  lock(false)
+{
+  only[0] = only[1] = 0;
+}
+
+void HashDiff::DiffThread::operator()()
+{
+  std::vector<DumpRecord> records[2];
+  unsigned b;
+  while (ok && diff->queue.next(b))
+  {
+    ok = diff->compare(b, records);
+    if (!ok)
+      diff->queue.stop();
+  }
+}
+
+static void appendLine(std::string & lines, char side, DumpRecord const & record) {
+  char line[80];
+  int n = snprintf(line, sizeof(line), "%c\t%016llx%016llx\t%u\t%u\n", side, (unsigned long long)record.high,
+                   (unsigned long long)record.low, record.lane, record.mate);
+  lines.append(line, n);
+}
+
+bool HashDiff::compare(unsigned b, std::vector<DumpRecord> * records)
+{
+  for (int s = 0; s < 2; ++s)
+  {
+    if (!sides[s].load(b, records[s]))
+      return false;
+    std::sort(records[s].begin(), records[s].end(), lessHash);
+  }
+
+  std::string bucketLines;
+  uint64_t bucketOnly[2] = {0, 0};
+  std::vector<DumpRecord> const & a = records[0];
+  std::vector<DumpRecord> const & c = records[1];
+  size_t i = 0, j = 0;
+  while (i < a.size() || j < c.size())
+  {
+    if (j == c.size() || (i < a.size() && lessHash(a[i], c[j])))
+    {
+      appendLine(bucketLines, '<', a[i++]);
+      bucketOnly[0]++;
+    }
+    else if (i == a.size() || lessHash(c[j], a[i]))
+    {
+      appendLine(bucketLines, '>', c[j++]);
+      bucketOnly[1]++;
+    }
+    else
+    {
+      ++i;
+      ++j;
+    }
+  }
+
+  print(b, bucketLines, bucketOnly);
+  return true;
+}
+
+void HashDiff::print(unsigned b, std::string & bucketLines, uint64_t const * bucketOnly)
+{
+  seqan::ScopedLock<seqan::Mutex> scopedLock(lock);
+  only[0] += bucketOnly[0];
+  only[1] += bucketOnly[1];
+  lines[b].swap(bucketLines);
+  done[b] = true;
+  for (; nextPrint < done.size() && done[nextPrint]; ++nextPrint)
+  {
+    std::cout << lines[nextPrint];
+    std::string().swap(lines[nextPrint]);
+  }
+}
+
+bool HashDiff::run(unsigned numThreads)
+{
+  std::vector<seqan::Thread<DiffThread> > threads(numThreads);
+  for (unsigned i = 0; i < numThreads; ++i)
+  {
+    threads[i].worker.diff = this;
+    threads[i].worker.ok = true;
+    seqan::run(threads[i]);
+  }
+
+  bool ok = true;
+  for (unsigned i = 0; i < numThreads; ++i)
+  {
+    waitFor(threads[i]);
+    ok = ok && threads[i].worker.ok;
+  }
+  return ok;
+}
+
+// The threads that compare the buckets of a pass, at most --threads and as
+// many as the largest buckets of the pass fit into --memory. Warns, once, when
+// that is fewer, and when a single bucket does not fit, which only happens
+// when the same hash is in the dumps very often.
+static unsigned diffThreads(std::vector<uint64_t> sizes, Diffinfo const & info, bool * warned) {
+  uint64_t memory = (uint64_t)info.memory << 20;
+  std::sort(sizes.begin(), sizes.end(), std::greater<uint64_t>());
+  if (sizes[0] > memory && !warned[0]) {
+    std::cerr << "WARNING: A bucket of " << (sizes[0] >> 20) << " MB of hashes is larger than --memory\n";
+    warned[0] = true;
+  }
+
+  unsigned threads = 1;
+  uint64_t held = sizes[0];
+  while (threads < (unsigned)info.threads && threads < sizes.size() && held + sizes[threads] <= memory) {
+    held += sizes[threads];
+    threads++;
+  }
+  if (threads < (unsigned)info.threads && threads < sizes.size() && !warned[1]) {
+    std::cerr << "WARNING: Comparing the buckets on " << threads << " threads to stay within --memory\n";
+    warned[1] = true;
+  }
+  return threads;
+}
+
+// Subtracts the --iblt tables of two sets of reads and prints the hashes that
+// are left, like the dumps but without read group and mate.
+static int diffTables(Diffinfo const & info) {
+  Iblt tables[2];
+  HashFunction functions[2];
+  for (int s = 0; s < 2; s++) {
+    if (!tables[s].read(info.dumps[s].c_str(), functions[s])) {
+      return 1;
+    }
+  }
+  if (functions[0] != functions[1]) {
+    std::cerr << "ERROR: " << info.dumps[0] << " and " << info.dumps[1] << " were hashed with different functions\n";
+    return 1;
+  }
+  if (tables[0].size() != tables[1].size()) {
+    std::cerr << "ERROR: " << info.dumps[0] << " and " << info.dumps[1] << " were written with different --iblt-cells\n";
+    return 1;
+  }
+
+  tables[0].add(tables[1], -1);
+  std::vector<IbltEntry> entries;
+  if (!tables[0].decode(entries)) {
+    std::cerr << "ERROR: The reads of " << info.dumps[0] << " and " << info.dumps[1]
+              << " differ in too many reads to recover, use more --iblt-cells or --dump-hashes\n";
+    return 1;
+  }
+
+  uint64_t only[2] = {0, 0};
+  for (size_t i = 0; i < entries.size(); i++) {
+    int s = entries[i].count > 0 ? 0 : 1;
+    for (int64_t n = 0; n < (entries[i].count > 0 ? entries[i].count : -entries[i].count); n++) {
+      printf("%c\t%016llx%016llx\n", s == 0 ? '<' : '>', (unsigned long long)entries[i].hash.p.high,
+             (unsigned long long)entries[i].hash.p.low);
+      only[s]++;
+    }
+  }
+  fflush(stdout);
+
+  if (only[0] > 0 || only[1] > 0) {
+    std::cerr << "WARNING: " << only[0] << " reads are only in " << info.dumps[0] << " and "
+              << only[1] << " only in " << info.dumps[1] << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char const **argv) {
+  Diffinfo info; // Define structure variable
+  seqan::ArgumentParser::ParseResult res = parseCommandLine(info, argc, argv); // Parse the command line.
+
+  if (res != seqan::ArgumentParser::PARSE_OK) {
+    return res == seqan::ArgumentParser::PARSE_ERROR;
+  }
+
+  if (isIbltFile(info.dumps[0].c_str()) || isIbltFile(info.dumps[1].c_str())) {
+    return diffTables(info);
+  }
+
+  DumpSide sides[2];
+  DumpHeader headers[2];
+  for (int s = 0; s < 2; s++) {
+    if (!sides[s].open(info.dumps[s].c_str(), headers[s])) {
+      return 1;
+    }
+  }
+  if (headers[0].function != headers[1].function) {
+    std::cerr << "ERROR: " << info.dumps[0] << " and " << info.dumps[1] << " were hashed with different functions\n";
+    return 1;
+  }
+
+  // Every thread holds a bucket of both sides. The buckets are sized by the
+  // number of records in the headers, with room for those that come out
+  // larger than the average.
+  uint64_t bytes = (headers[0].records + headers[1].records) * sizeof(DumpRecord);
+  uint64_t budget = ((uint64_t)info.memory << 20) / info.threads / 4 * 3;
+  unsigned bits = 0;
+  while (bits < BAMHASH_DIFF_MAX_BITS && (bytes >> bits) > budget) {
+    bits++;
+  }
+
+  unsigned passBuckets = 1 << (bits < BAMHASH_DIFF_PASS_BITS ? bits : BAMHASH_DIFF_PASS_BITS);
+  uint64_t only[2] = {0, 0};
+  bool warned[2] = {false, false};
+  for (unsigned first = 0; first < (1u << bits); first += passBuckets) {
+    for (int s = 0; s < 2; s++) {
+      if (!sides[s].split(bits, first, passBuckets, info.tmpDir)) {
+        return 1;
+      }
+    }
+
+    HashDiff diff(sides, passBuckets);
+    if (!diff.run(diffThreads(bucketSizes(sides, passBuckets), info, warned))) {
+      return 1;
+    }
+    only[0] += diff.only[0];
+    only[1] += diff.only[1];
+  }
+  std::cout.flush();
+
+  if (only[0] > 0 || only[1] > 0) {
+    std::cerr << "WARNING: " << only[0] << " reads are only in " << info.dumps[0] << " and "
+              << only[1] << " only in " << info.dumps[1] << "\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,276 @@
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bamhash_dump.h"
+
+static void appendLittle(std::string & data, uint32_t value, int bytes) {
+  for (int i = 0; i < bytes; i++) {
+    data += (char)(value >> (8 * i));
+  }
+}
+
+// A gzip member that holds data in a stored deflate block. Its size only
+// depends on the length of the data, so it can be overwritten in place.
+static std::string storedGzipMember(std::string const & data) {
+  std::string member("\x1f\x8b\x08\0\0\0\0\0\0\xff", 10);
+  member += '\x01'; // the final block, stored
+  appendLittle(member, data.size(), 2);
+  appendLittle(member, ~data.size(), 2);
+  member += data;
+  appendLittle(member, crc32(crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef *>(data.data()), data.size()), 4);
+  appendLittle(member, data.size(), 4);
+  return member;
+}
+
+// Writes the header at the start of file.
+static bool writeHeader(FILE * file, DumpHeader const & header, bool compressed) {
+  std::string data(reinterpret_cast<const char *>(&header), sizeof(header));
+  if (compressed) {
+    data = storedGzipMember(data);
+  }
+  return fwrite(data.data(), 1, data.size(), file) == data.size();
+}
+
+void HashDump::WriteThread::operator()()
+{
+  seqan::ScopedReadLock<TBufferQueue> readLock(*dump->fullQueue);
+  seqan::ScopedWriteLock<TBufferQueue> writeLock(*dump->freeQueue);
+
+  int bufferId = -1;
+
+  // returns false once the dump is closed and the queue is drained
+  while (popFront(bufferId, *dump->fullQueue))
+  {
+    std::string & buffer = dump->buffers[bufferId];
+    if (!dump->failed && !dump->writeData(buffer.data(), buffer.size()))
+      dump->failed = true;
+    buffer.clear();
+    appendValue(*dump->freeQueue, bufferId);
+  }
+}
+
+HashDump::HashDump() :
+  bucketBits(0),
+  compressed(false),
+  records(0),
+  file(NULL),
+  gz(NULL),
+  failed(false),
+  buffers(BAMHASH_DUMP_BUFFERS),
+  current(0),
+  lock(false),
+  fullQueue(NULL),
+  freeQueue(NULL),
+  thread(NULL)
+{}
+
+HashDump::~HashDump()
+{
+  close();
+}
+
+bool HashDump::open(const char * fileName_, HashFunction function)
+{
+  fileName = fileName_;
+  size_t length = fileName.size();
+  compressed = length > 3 && fileName.compare(length - 3, 3, ".gz") == 0;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, BAMHASH_DUMP_MAGIC, sizeof(header.magic));
+  header.function = function;
+  header.recordSize = sizeof(DumpRecord);
+  header.records = BAMHASH_DUMP_UNFINISHED;
+
+  // the records of a ".gz" file are compressed into a member after the header
+  file = fopen(fileName_, "wb");
+  bool ok = file != NULL && writeHeader(file, header, compressed);
+  if (ok && compressed)
+  {
+    ok = fclose(file) == 0;
+    file = NULL;
+    ok = ok && (gz = gzopen(fileName_, "ab1")) != NULL;
+  }
+  if (!ok)
+  {
+    if (file != NULL)
+      fclose(file);
+    file = NULL;
+    std::cerr << "ERROR: Could not open the file: " << fileName << " for writing.\n";
+    return false;
+  }
+  buffers[current].reserve(BAMHASH_DUMP_BUFFER);
+
+  fullQueue = new TBufferQueue(buffers.size());
+  freeQueue = new TBufferQueue(buffers.size());
+  lockWriting(*fullQueue);
+  lockReading(*freeQueue);
+  setReaderWriterCount(*fullQueue, 1, 1);
+  setReaderWriterCount(*freeQueue, 1, 1);
+  for (int i = 0; i < (int)buffers.size(); ++i)
+  {
+    if (i != current)
+      appendValue(*freeQueue, i);
+  }
+
+  thread = new seqan::Thread<WriteThread>;
+  thread->worker.dump = this;
+  run(*thread);
+  return true;
+}
+
+void HashDump::selectBuckets(unsigned bits, std::vector<char> const & selected)
+{
+  bucketBits = bits;
+  selectedBuckets = selected;
+}
+
+void HashDump::write(HashBatch const & batch)
+{
+  seqan::ScopedLock<seqan::Mutex> scopedLock(lock);
+
+  for (size_t i = 0; i < batch.size; ++i)
+  {
+    if (bucketBits > 0 && !selectedBuckets[BucketSums::bucket(batch.hashes[i], bucketBits)])
+      continue;
+
+    DumpRecord record;
+    record.low = batch.hashes[i].p.low;
+    record.high = batch.hashes[i].p.high;
+    record.lane = batch.lanes[i];
+    record.mate = batch.mates[i];
+    buffers[current].append(reinterpret_cast<const char *>(&record), sizeof(record));
+    ++records;
+  }
+
+  // waits while the writing thread is behind
+  if (buffers[current].size() >= BAMHASH_DUMP_BUFFER)
+  {
+    appendValue(*fullQueue, current);
+    popFront(current, *freeQueue);
+  }
+}
+
+bool HashDump::writeData(const char * data, size_t length)
+{
+  if (gz != NULL)
+    return gzwrite(gz, data, length) == (int)length;
+  return fwrite(data, 1, length, file) == length;
+}
+
+bool HashDump::close()
+{
+  if (thread == NULL)
+    return true;
+
+  if (!buffers[current].empty())
+    appendValue(*fullQueue, current);
+  unlockWriting(*fullQueue);
+  unlockReading(*freeQueue);
+  waitFor(*thread);
+  delete thread;
+  thread = NULL;
+  delete fullQueue;
+  delete freeQueue;
+  fullQueue = freeQueue = NULL;
+
+  if (gz != NULL && gzclose(gz) != Z_OK)
+    failed = true;
+  if (file != NULL && fclose(file) != 0)
+    failed = true;
+  gz = NULL;
+  file = NULL;
+
+  // a dump that is cut short keeps BAMHASH_DUMP_UNFINISHED
+  if (!failed)
+  {
+    header.records = records;
+    FILE * headerFile = fopen(fileName.c_str(), "r+b");
+    if (headerFile == NULL || !writeHeader(headerFile, header, compressed))
+      failed = true;
+    if (headerFile != NULL && fclose(headerFile) != 0)
+      failed = true;
+  }
+
+  if (failed)
+  {
+    std::cerr << "ERROR: Could not write to " << fileName << "\n";
+    return false;
+  }
+  return true;
+}
+
+bool writeBucketSums(const char * fileName, BucketSums const & buckets, HashFunction function)
+{
+  FILE * file = fopen(fileName, "w");
+  if (file == NULL)
+  {
+    std::cerr << "ERROR: Could not open the file: " << fileName << " for writing.\n";
+    return false;
+  }
+
+  int digits = buckets.bits / 4;
+  const char * name = hashFunctionName(function);
+  fprintf(file, "# bamhash bucket sums\t%s\t%u\n", name, buckets.bits);
+  for (size_t b = 0; b < buckets.sums.size(); ++b)
+    fprintf(file, "%0*zx\t%016llx\t%s\n", digits, b, (unsigned long long)buckets.sums[b], name);
+
+  if (ferror(file) || fclose(file) != 0)
+  {
+    std::cerr << "ERROR: Could not write to " << fileName << "\n";
+    return false;
+  }
+  return true;
+}
+
+bool readBuckets(const char * fileName, unsigned bits, HashFunction function, std::vector<char> & selected)
+{
+  std::ifstream in(fileName);
+  if (!in)
+  {
+    std::cerr << "ERROR: Could not open the file: " << fileName << " for reading.\n";
+    return false;
+  }
+
+  selected.assign((size_t)1 << bits, false);
+  size_t digits = bits / 4;
+  const char * name = hashFunctionName(function);
+  size_t numSelected = 0;
+  std::string line;
+  while (std::getline(in, line))
+  {
+    size_t pos = 0;
+    if (pos < line.size() && (line[pos] == '<' || line[pos] == '>'))
+      ++pos;
+    while (pos < line.size() && line[pos] == ' ')
+      ++pos;
+
+    // the bucket, its sum and the hash function, other lines are skipped
+    std::istringstream fields(line.substr(pos));
+    std::string bucket, sum, bucketFunction;
+    if (!std::getline(fields, bucket, '\t') || !std::getline(fields, sum, '\t') || !std::getline(fields, bucketFunction) ||
+        bucket.empty() || strspn(bucket.c_str(), "0123456789abcdefABCDEF") != bucket.size())
+      continue;
+
+    if (bucketFunction != name)
+    {
+      std::cerr << "ERROR: " << fileName << " lists the buckets of " << bucketFunction << " hashes, not of " << name << "\n";
+      return false;
+    }
+    if (bucket.size() != digits)
+    {
+      std::cerr << "ERROR: " << fileName << " lists buckets of " << bucket.size() * 4 << " bits, not of --bucket-bits "
+                << bits << "\n";
+      return false;
+    }
+    size_t b = strtoul(bucket.c_str(), NULL, 16);
+    numSelected += !selected[b];
+    selected[b] = true;
+  }
+
+  if (numSelected == 0)
+    std::cerr << "WARNING: No buckets are listed in " << fileName << ", no reads are written to --dump-hashes\n";
+  return true;
+}
@@ -0,0 +1,124 @@
+#ifndef BAMHASH_DUMP_H
+#define BAMHASH_DUMP_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+#include <seqan/basic.h>
+#include <seqan/parallel.h>
+#include <seqan/system.h>
+
+#include "bamhash_checksum_common.h"
+
+// Bytes of records collected before they are handed to the writing thread,
+// and the buffers in flight.
+#define BAMHASH_DUMP_BUFFER (4 << 20)
+#define BAMHASH_DUMP_BUFFERS 4
+
+// -----------------------------------------------------------------------------
+// STRUCT DumpRecord
+// -----------------------------------------------------------------------------
+
+// The hash of one read in a --dump-hashes file. The file starts with a
+// DumpHeader, followed by one record per read, all little endian. Records are
+// in the order the batches were hashed in, which depends on the threads. The
+// header of a ".gz" file is a gzip member of its own that is stored, not
+// compressed, so the number of records can be filled in once all are written.
+
+struct DumpHeader {
+  char magic[8];     // BAMHASH_DUMP_MAGIC
+  uint32_t function; // the HashFunction of the reads
+  uint32_t recordSize;
+  uint64_t records;  // BAMHASH_DUMP_UNFINISHED until the dump is closed
+};
+
+#define BAMHASH_DUMP_MAGIC "BHDUMP2"
+#define BAMHASH_DUMP_UNFINISHED (~(uint64_t)0)
+
+struct DumpRecord {
+  uint64_t low;  // the hash, as summed by Counts
+  uint64_t high;
+  uint32_t lane; // the read group, as counted by the checksum, 0 for FASTQ and FASTA
+  uint32_t mate; // 1 or 2, the "/1" or "/2" that the hashed name ends in
+};
+
+// -----------------------------------------------------------------------------
+// CLASS HashDump
+// -----------------------------------------------------------------------------
+
+// Writes the hash of every read to a file, see DumpRecord. The records of a
+// batch are copied into a big buffer and full buffers are written, or
+// compressed when the file name ends in ".gz", by a thread of its own, so
+// the hashing threads rarely wait for the disk. write() may be called by
+// several threads at once.
+
+class HashDump
+{
+  public:
+  typedef seqan::ConcurrentQueue<int, seqan::Suspendable<seqan::Limit> > TBufferQueue;
+
+  struct WriteThread
+  {
+    HashDump * dump;
+
+    void operator()();
+  };
+
+  HashDump();
+  ~HashDump();
+
+  // Returns false if the file can't be opened, after printing it.
+  bool open(const char * fileName, HashFunction function);
+
+  // Only writes the reads in the given buckets of 2^bits, see BucketSums.
+  void selectBuckets(unsigned bits, std::vector<char> const & selected);
+
+  // Adds the hashes of a batch that has been hashed.
+  void write(HashBatch const & batch);
+
+  // Writes what is left. Returns false if writing failed, after printing it.
+  bool close();
+
+  private:
+  bool writeData(const char * data, size_t length);
+
+  std::string fileName;
+  unsigned bucketBits;
+  std::vector<char> selectedBuckets;
+  bool compressed;
+  DumpHeader header;
+  uint64_t records;
+  FILE * file;
+  gzFile gz;
+  bool failed;
+  std::vector<std::string> buffers;
+  int current; // the buffer write() fills
+  seqan::Mutex lock;
+  TBufferQueue * fullQueue;
+  TBufferQueue * freeQueue;
+  seqan::Thread<WriteThread> * thread;
+};
+
+// -----------------------------------------------------------------------------
+// FUNCTION writeBucketSums()
+// -----------------------------------------------------------------------------
+
+// Writes the bucket sums of --bucket-sums as text: a line starting with '#'
+// with the hash function and the bits, then a line per bucket with the bucket
+// and its sum in hex and the hash function. The bucket has bits / 4 digits,
+// the first digits of the hashes that bamhash_diff prints. Files of two sets
+// of reads can be compared with diff, whose output keeps the width and the
+// function on every line. Returns false on an error, after printing it.
+bool writeBucketSums(const char * fileName, BucketSums const & buckets, HashFunction function);
+
+// Reads the buckets of --dump-buckets: every line of a bucket, its sum and
+// hash function, after an optional '<' or '>' and spaces, as in the output of
+// diff on two --bucket-sums files. selected[b] is set for those. Returns false
+// on an error, or if a bucket is not of bits / 4 digits or of function, after
+// printing it. Warns if no bucket is listed.
+bool readBuckets(const char * fileName, unsigned bits, HashFunction function, std::vector<char> & selected);
+
+#endif // BAMHASH_DUMP_H
@@ -0,0 +1,638 @@
+#include <iostream>
+#include <string.h>
+
+#include "bamhash_fastq.h"
+#include "bamhash_cache.h"
+
+// The first '\n' or '\r' in [p, end), or end.
+static inline const char * findNewline(const char * p, const char * end)
+{
+  const char * n = static_cast<const char *>(memchr(p, '\n', end - p));
+  if (n == NULL)
+    n = end;
+  const char * r = static_cast<const char *>(memchr(p, '\r', n - p));
+  return r != NULL ? r : n;
+}
+
+static inline bool isNewline(char c)
+{
+  return c == '\n' || c == '\r';
+}
+
+FastqReader::FastqReader() :
+  buffer(BAMHASH_FASTQ_BLOCK),
+  pos(0),
+  end(0),
+  eof(false)
+{}
+
+bool FastqReader::open(const char * fileName, unsigned numThreads)
+{
+  pos = end = 0;
+  eof = false;
+  return input.open(fileName, numThreads);
+}
+
+void FastqReader::close()
+{
+  input.close();
+  pos = end = 0;
+  eof = false;
+}
+
+// Moves the unparsed input to the front of the buffer and reads more after it,
+// false at the end of the file.
+bool FastqReader::fill()
+{
+  if (eof)
+    return false;
+
+  size_t keep = end - pos;
+  memmove(&buffer[0], &buffer[pos], keep);
+  pos = 0;
+  end = keep;
+
+  // a record longer than the buffer
+  if (end == buffer.size())
+    buffer.resize(buffer.size() * 2);
+
+  // a stream buffer that fails ends the input, see InputFile::read()
+  std::streamsize n = input.read(&buffer[end], buffer.size() - end);
+  if (n <= 0)
+  {
+    eof = true;
+    return false;
+  }
+  end += n;
+  return true;
+}
+
+bool FastqReader::atEnd()
+{
+  while (true)
+  {
+    const char * at = static_cast<const char *>(memchr(&buffer[pos], '@', end - pos));
+    if (at != NULL)
+    {
+      pos = at - &buffer[0];
+      return false;
+    }
+    pos = end;
+    if (!fill())
+      return true;
+  }
+}
+
+void FastqReader::readRecord(FastqRecord & record)
+{
+  if (atEnd())
+    throw seqan::UnexpectedEnd();
+
+  while (true)
+  {
+    const char * next = parse(&buffer[pos], &buffer[0] + end, record);
+    if (next != NULL)
+    {
+      pos = next - &buffer[0];
+      return;
+    }
+    // the record runs past the buffer, parse it again with more input
+    fill();
+  }
+}
+
+// Parses the record at the '@' at p. Returns the end of the record, or NULL if
+// it runs past last and there is more input.
+const char * FastqReader::parse(const char * p, const char * last, FastqRecord & record)
+{
+  ++p; // '@'
+
+  // id line
+  const char * e = findNewline(p, last);
+  if (e == last && !eof)
+    return NULL;
+  record.id = TextView(p, e - p);
+  p = e;
+  if (p < last && *p == '\r' && ++p == last && !eof)
+    return NULL;
+  if (p < last && *p == '\n')
+    ++p;
+
+  // sequence up to the '+', usually a single line
+  e = findNewline(p, last);
+  if (e + 1 < last && *e == '\n' && e[1] == '+' && memchr(p, '+', e - p) == NULL)
+  {
+    record.seq = TextView(p, e - p);
+    p = e + 1;
+  }
+  else
+  {
+    seqCopy.clear();
+    for (; p < last && *p != '+'; ++p)
+    {
+      if (!isNewline(*p))
+        seqCopy.push_back(*p);
+    }
+    if (p == last)
+    {
+      if (!eof)
+        return NULL;
+      pos = end;
+      throw seqan::UnexpectedEnd();
+    }
+    record.seq = TextView(seqCopy);
+  }
+
+  // skip the '+' line
+  e = findNewline(p + 1, last);
+  if (e == last && !eof)
+    return NULL;
+  p = e;
+  if (p < last && *p == '\r' && ++p == last && !eof)
+    return NULL;
+  if (p < last && *p == '\n')
+    ++p;
+
+  // as many qualities as there are bases, '@' is a valid quality
+  size_t length = record.seq.size;
+  if ((size_t)(last - p) >= length && memchr(p, '\n', length) == NULL && memchr(p, '\r', length) == NULL)
+  {
+    record.qual = TextView(p, length);
+    return p + length;
+  }
+
+  qualCopy.clear();
+  for (; p < last && qualCopy.size() < length; ++p)
+  {
+    if (!isNewline(*p))
+      qualCopy.push_back(*p);
+  }
+  if (qualCopy.size() < length && !eof)
+    return NULL;
+  record.qual = TextView(qualCopy);
+  return p;
+}
+
+void FastqBatch::clear()
+{
+  text.clear();
+  fields.clear();
+  size = next = 0;
+  atEnd = failed = false;
+}
+
+void FastqBatch::add(FastqRecord const & record)
+{
+  TextView const * parts[3] = {&record.id, &record.seq, &record.qual};
+  for (int i = 0; i < 3; ++i)
+  {
+    fields.push_back(text.size());
+    fields.push_back(parts[i]->size);
+    text.append(parts[i]->data, parts[i]->size);
+  }
+  ++size;
+}
+
+void FastqBatch::get(size_t i, FastqRecord & record) const
+{
+  size_t const * f = &fields[6 * i];
+  record.id = TextView(text.data() + f[0], f[1]);
+  record.seq = TextView(text.data() + f[2], f[3]);
+  record.qual = TextView(text.data() + f[4], f[5]);
+}
+
+void ThreadedFastqReader::ReadThread::operator()()
+{
+  seqan::ScopedReadLock<TBatchQueue> readLock(*reader->idleQueue);
+  seqan::ScopedWriteLock<TBatchQueue> writeLock(*reader->readyQueue);
+
+  FastqRecord record;
+  int batchId = -1;
+
+  // returns false once the caller stopped reading
+  while (popFront(batchId, *reader->idleQueue))
+  {
+    FastqBatch & batch = reader->batches[batchId];
+    batch.clear();
+    while (!batch.full())
+    {
+      if (reader->reader.atEnd())
+      {
+        batch.atEnd = true;
+        break;
+      }
+      try
+      {
+        reader->reader.readRecord(record);
+      }
+      catch (seqan::Exception const & e)
+      {
+        batch.failed = true;
+        break;
+      }
+      batch.add(record);
+    }
+
+    if (!appendValue(*reader->readyQueue, batchId) || batch.atEnd || batch.failed)
+      break;
+  }
+}
+
+ThreadedFastqReader::ThreadedFastqReader() :
+  batches(BAMHASH_FASTQ_BATCHES),
+  current(-1),
+  readyQueue(NULL),
+  idleQueue(NULL),
+  thread(NULL)
+{}
+
+ThreadedFastqReader::~ThreadedFastqReader()
+{
+  close();
+}
+
+bool ThreadedFastqReader::open(const char * fileName, unsigned numThreads)
+{
+  close();
+  if (!reader.open(fileName, numThreads))
+    return false;
+
+  readyQueue = new TBatchQueue(batches.size());
+  idleQueue = new TBatchQueue(batches.size());
+  lockReading(*readyQueue);
+  lockWriting(*idleQueue);
+  setReaderWriterCount(*readyQueue, 1, 1);
+  setReaderWriterCount(*idleQueue, 1, 1);
+  for (int i = 0; i < (int)batches.size(); ++i)
+    appendValue(*idleQueue, i);
+
+  thread = new seqan::Thread<ReadThread>;
+  thread->worker.reader = this;
+  run(*thread);
+  return true;
+}
+
+void ThreadedFastqReader::stop()
+{
+  if (thread == NULL)
+    return;
+
+  // the reading thread finds no more free batches, or no room for a full one
+  unlockWriting(*idleQueue);
+  unlockReading(*readyQueue);
+  waitFor(*thread);
+  delete thread;
+  thread = NULL;
+}
+
+void ThreadedFastqReader::close()
+{
+  stop();
+  delete readyQueue;
+  delete idleQueue;
+  readyQueue = idleQueue = NULL;
+  current = -1;
+  reader.close();
+}
+
+bool ThreadedFastqReader::atEnd()
+{
+  while (true)
+  {
+    if (current >= 0)
+    {
+      FastqBatch & batch = batches[current];
+      if (batch.next < batch.size)
+        return false;
+      // the reader is where the reading thread stopped
+      if (batch.failed)
+        return thread == NULL ? reader.atEnd() : false;
+      if (batch.atEnd)
+        return true;
+      appendValue(*idleQueue, current);
+      current = -1;
+    }
+
+    if (thread == NULL || !popFront(current, *readyQueue))
+    {
+      current = -1;
+      return true;
+    }
+  }
+}
+
+void ThreadedFastqReader::readRecord(FastqRecord & record)
+{
+  if (atEnd())
+    throw seqan::UnexpectedEnd();
+
+  FastqBatch & batch = batches[current];
+  if (batch.next < batch.size)
+  {
+    batch.get(batch.next++, record);
+    return;
+  }
+
+  // the record after the batch could not be read
+  stop();
+  throw seqan::UnexpectedEnd();
+}
+
+bool ThreadedFastqReader::readError(const char * fileName)
+{
+  stop();
+  return reader.readError(fileName);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION appendRead()
+// -----------------------------------------------------------------------------
+
+// Appends the hashed string of a read to a std::string or a HashStream.
+
+template <typename TTarget>
+void appendRead(TTarget & target, TextView const & name, int mate, FastqRecord const & record, Fastqinfo const & info)
+{
+  if (!info.noReadNames) {
+    target.append(name.data, name.size);
+    target.append(mate == 2 ? "/2" : "/1");
+  }
+  target.append(record.seq.data, record.seq.size);
+  if (!info.noQuality) {
+    target.append(record.qual.data, record.qual.size);
+  }
+}
+
+// Adds a read to the batch, very long reads are hashed straight from the input.
+void addRead(HashPipeline & pipeline, TextView const & name, int mate, FastqRecord const & record, Fastqinfo const & info)
+{
+  HashBatch & batch = pipeline.batch();
+  if (pipeline.streams(name.size + record.seq.size + record.qual.size)) {
+    HashStream stream(pipeline.hashFunction());
+    appendRead(stream, name, mate, record, info);
+    batch.addHash(stream.final(), 0, mate);
+  } else {
+    appendRead(batch.add(0, mate), name, mate, record, info);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION hashFastq()
+// -----------------------------------------------------------------------------
+
+// Hashes the reads of one FASTQ file, or of a pair of files when fastq2 is
+// not empty. count is the number of reads (pairs) so far. Returns false on an
+// error, after printing it.
+
+template <typename TReader>
+bool hashFastq(HashPipeline & pipeline, TReader & reader1, TReader & reader2, const char * fastq1, const char * fastq2,
+               Fastqinfo const & info, unsigned & count)
+{
+  FastqRecord record1;
+  FastqRecord record2;
+
+  if (!reader1.open(fastq1, info.threads))
+  {
+      std::cerr << "ERROR: Could not open the file: " << fastq1 << " for reading.\n";
+      return false;
+  }
+
+  if (info.paired) {
+      if (!reader2.open(fastq2, info.threads))
+      {
+          std::cerr << "ERROR: Could not open the file: " << fastq2 << " for reading.\n";
+          return false;
+      }
+  }
+
+  // Read record
+  while (!reader1.atEnd()) {
+    if(info.paired)
+    {
+      if(reader2.atEnd()) { break; }
+    }
+    try
+    {
+        reader1.readRecord(record1);
+    }
+    catch (seqan::Exception const & e)
+    {
+      if (reader1.readError(fastq1))
+      {
+        return false;
+      }
+      if (reader1.atEnd())
+      {
+        std::cerr << "WARNING: Could not continue reading " << fastq1 <<  " at line: " << count+1 << ". Check if files have the same number of reads.\n";
+        return false;
+      }
+      std::cerr << "ERROR: Could not read from " << fastq1 << "\n";
+      return false;
+    }
+
+    try
+    {
+      if (info.paired)
+      {
+          reader2.readRecord(record2);
+      }
+    }
+    catch (seqan::Exception const & e)
+    {
+      if (reader2.readError(fastq2))
+      {
+        return false;
+      }
+      if (reader2.atEnd())
+      {
+        std::cerr << "WARNING: Could not continue reading " << fastq2 << " at line: " << count+1 << ". Check if files have the same number of reads.\n";
+        return false;
+      }
+      std::cerr << "ERROR: Could not read from " << fastq2 << "\n";
+      return false;
+    }
+
+    count +=1;
+
+    // If include id, then cut id on first whitespace
+    TextView name1 = readName(record1.id);
+    TextView name2 = info.paired ? readName(record2.id) : TextView();
+
+    // Check if names are in same order in both files
+    if (info.paired && !info.noReadNames &&
+        (name1.size != name2.size || memcmp(name1.data, name2.data, name1.size) != 0)) {
+      std::cerr << "WARNING: Id_names in line: " << count << " are not in the same order\n";
+      return false;
+    }
+
+    addRead(pipeline, name1, 1, record1, info);
+    if (info.paired) {
+      addRead(pipeline, name2, 2, record2, info);
+    }
+
+    // Hand the batch over for hashing once it is full
+    if (pipeline.batch().full()) {
+      pipeline.submit();
+    }
+
+  }
+
+  // a broken gzip file can end on a record boundary
+  if (reader1.readError(fastq1) || reader2.readError(fastq2)) {
+    return false;
+  }
+
+  reader1.close();
+  reader2.close();
+  return true;
+}
+
+// The two files of a pair are read on threads of their own.
+
+bool hashFastq(HashPipeline & pipeline, const char * fastq1, const char * fastq2, Fastqinfo const & info, unsigned & count)
+{
+  if (info.paired)
+  {
+    ThreadedFastqReader reader1;
+    ThreadedFastqReader reader2;
+    return hashFastq(pipeline, reader1, reader2, fastq1, fastq2, info, count);
+  }
+
+  FastqReader reader1;
+  FastqReader reader2;
+  return hashFastq(pipeline, reader1, reader2, fastq1, fastq2, info, count);
+}
+
+// -----------------------------------------------------------------------------
+// CLASS FastqJob
+// -----------------------------------------------------------------------------
+
+// A file, or a pair of files, read with --files, see hashJobs().
+
+struct FastqJob
+{
+  Fastqinfo const & info;
+
+  FastqJob(Fastqinfo const & info_) : info(info_) {}
+
+  // The first file of job i.
+  size_t first(unsigned job) const
+  {
+    return info.paired ? 2 * job : job;
+  }
+
+  bool operator()(HashPipeline & pipeline, unsigned job, unsigned & count) const
+  {
+    const char * fastq2 = info.paired ? info.fastqfiles[first(job) + 1].c_str() : "";
+    return hashFastq(pipeline, info.fastqfiles[first(job)].c_str(), fastq2, info, count);
+  }
+};
+
+// -----------------------------------------------------------------------------
+// FUNCTION hashFastqFiles()
+// -----------------------------------------------------------------------------
+
+bool hashFastqFiles(Fastqinfo const & info, Counts & sum, unsigned & count)
+{
+  // --dump-hashes writes every hash on a thread of its own, of all reads or
+  // those in the buckets of --dump-buckets
+  HashDump dump;
+  if (!info.dumpHashes.empty()) {
+    if (!dump.open(info.dumpHashes.c_str(), info.hash)) {
+      return false;
+    }
+    if (!info.dumpBuckets.empty()) {
+      std::vector<char> selected;
+      if (!readBuckets(info.dumpBuckets.c_str(), info.bucketBits, info.hash, selected)) {
+        return false;
+      }
+      dump.selectBuckets(info.bucketBits, selected);
+    }
+  }
+  HashPipeline pipeline(info.hashThreads, info.debug, info.hash, info.dumpHashes.empty() ? NULL : &dump,
+                        info.bucketSums.empty() ? 0 : info.bucketBits, info.iblt.empty() ? 0 : info.ibltCells);
+  // --debug has always printed the second read of a pair without the space
+  pipeline.setMate2Separator("");
+  std::vector<Counts> counts(1);
+
+  if (info.paired && (info.fastqfiles.size() % 2 != 0)) {
+    std::cerr << "ERROR: Running with paired end mode, but supplied an odd number of input files ";
+    for (size_t i = 0; i < info.fastqfiles.size(); i++) {
+      std::cerr << info.fastqfiles[i] << " ";
+    }
+    std::cerr << std::endl;
+    return false;
+  }
+
+  // --debug and the files of all reads need every read in the one pipeline
+  bool onePipeline = info.debug || !info.dumpHashes.empty() || !info.bucketSums.empty() || !info.iblt.empty();
+
+  if (info.cache && !onePipeline) {
+    // Every file, or pair of files, is hashed by itself unless the sidecar of
+    // its first file is up to date
+    std::string options = cacheOptions("fastq", info.hash, info.noReadNames, info.noQuality, info.paired);
+    FastqJob job(info);
+    for (unsigned i = 0; job.first(i) < info.fastqfiles.size(); i++) {
+      std::vector<std::string> files(info.fastqfiles.begin() + job.first(i),
+                                     info.fastqfiles.begin() + job.first(i) + (info.paired ? 2 : 1));
+      std::vector<FileFingerprint> prints;
+      bool fingerprinted = fingerprintFiles(files, prints);
+      CacheEntry entry;
+      if (!fingerprinted || info.recompute || !readCache(files, prints, options, entry) || entry.lanes.size() != 1) {
+        HashPipeline filePipeline(info.hashThreads, false, info.hash);
+        unsigned fileCount = 0;
+        if (!job(filePipeline, i, fileCount)) {
+          return false;
+        }
+        std::vector<Counts> fileCounts(1);
+        filePipeline.finish(fileCounts);
+        entry.lanes.assign(1, std::make_pair(std::string(), fileCounts[0]));
+        entry.count = fileCount;
+        if (fingerprinted) {
+          writeCache(files, prints, options, entry);
+        }
+      }
+      counts[0].add(entry.lanes[0].second);
+      count += entry.count;
+    }
+  } else if (info.files > 0 && !onePipeline) {
+    // The files, or pairs of files, are read at the same time, the largest first
+    FastqJob job(info);
+    std::vector<uint64_t> sizes;
+    for (unsigned i = 0; job.first(i) < info.fastqfiles.size(); i++) {
+      uint64_t size = fileSize(info.fastqfiles[job.first(i)].c_str());
+      if (info.paired) {
+        size += fileSize(info.fastqfiles[job.first(i) + 1].c_str());
+      }
+      sizes.push_back(size);
+    }
+
+    if (!hashJobs(job, sizes, info.files, info.hash, counts, count)) {
+      return false;
+    }
+  } else {
+    for (size_t i = 0; i < info.fastqfiles.size(); i += (info.paired) ? 2 : 1) {
+      const char* fastq1 = info.fastqfiles[i].c_str();
+      const char* fastq2 = "";
+      if (info.paired) {
+       fastq2 = info.fastqfiles[i+1].c_str();
+      }
+
+      if (!hashFastq(pipeline, fastq1, fastq2, info, count)) {
+        return false;
+      }
+    }
+  }
+  pipeline.finish(counts);
+  if (!dump.close()) {
+    return false;
+  }
+  if (!info.bucketSums.empty() && !writeBucketSums(info.bucketSums.c_str(), pipeline.bucketSums(), info.hash)) {
+    return false;
+  }
+  if (!info.iblt.empty() && !pipeline.readTable().write(info.iblt.c_str(), info.hash)) {
+    return false;
+  }
+  sum = counts[0];
+  return true;
+}
@@ -0,0 +1,194 @@
+#ifndef BAMHASH_FASTQ_H
+#define BAMHASH_FASTQ_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include <seqan/parallel.h>
+
+#include "bamhash_checksum_common.h"
+#include "bamhash_pipeline.h"
+#include "bamhash_seqfile.h"
+
+// Bytes read from the input at once. The buffer grows for longer records.
+#define BAMHASH_FASTQ_BLOCK (4 << 20)
+
+// Records handed over at once by a ThreadedFastqReader, a batch is also cut
+// once it holds BAMHASH_FASTQ_BATCH_BYTES, and the batches in flight.
+#define BAMHASH_FASTQ_BATCH_RECORDS 1024
+#define BAMHASH_FASTQ_BATCH_BYTES (1 << 20)
+#define BAMHASH_FASTQ_BATCHES 4
+
+// -----------------------------------------------------------------------------
+// STRUCT FastqRecord
+// -----------------------------------------------------------------------------
+
+// A read as seqan::readRecord() returns it: the whole id line, and sequence and
+// qualities with line breaks removed. Valid until the next readRecord().
+struct FastqRecord
+{
+  TextView id;
+  TextView seq;
+  TextView qual;
+};
+
+// -----------------------------------------------------------------------------
+// CLASS FastqReader
+// -----------------------------------------------------------------------------
+
+// Splits a FASTQ file into records without going through seqan's stream
+// iterators. The input is read in big blocks, line ends are found with memchr()
+// and the fields of a record point straight into the block. Only records whose
+// sequence or qualities span several lines, or that use "\r\n" line ends, are
+// copied. Parsing follows seqan's FASTQ reader, so the fields are the same.
+
+class FastqReader
+{
+  public:
+  FastqReader();
+
+  bool open(const char * fileName, unsigned numThreads);
+  void close();
+
+  // True when there is no '@' left in the file.
+  bool atEnd();
+
+  // Reads the next record, throws seqan::UnexpectedEnd on a truncated one.
+  void readRecord(FastqRecord & record);
+
+  bool readError(const char * fileName) const
+  {
+    return input.readError(fileName);
+  }
+
+  private:
+  bool fill();
+  const char * parse(const char * p, const char * last, FastqRecord & record);
+
+  InputFile input;
+  std::vector<char> buffer;
+  size_t pos;     // start of the unparsed input
+  size_t end;     // end of the input in buffer
+  bool eof;
+
+  // sequence and qualities of records that span several lines
+  std::string seqCopy;
+  std::string qualCopy;
+};
+
+// -----------------------------------------------------------------------------
+// STRUCT FastqBatch
+// -----------------------------------------------------------------------------
+
+// Records copied out of a FastqReader, all fields in one string.
+struct FastqBatch
+{
+  std::string text;
+  std::vector<size_t> fields; // offset and length of id, seq and qual of every record
+  size_t size;                // records
+  size_t next;                // the next record to hand out
+  bool atEnd;                 // the file ends after the records
+  bool failed;                // reading the record after them threw
+
+  FastqBatch() : size(0), next(0), atEnd(false), failed(false) {}
+
+  void clear();
+  void add(FastqRecord const & record);
+  // Record i, valid until the batch is cleared.
+  void get(size_t i, FastqRecord & record) const;
+
+  bool full() const
+  {
+    return size == BAMHASH_FASTQ_BATCH_RECORDS || text.size() >= BAMHASH_FASTQ_BATCH_BYTES;
+  }
+};
+
+// -----------------------------------------------------------------------------
+// CLASS ThreadedFastqReader
+// -----------------------------------------------------------------------------
+
+// A FastqReader that runs on a thread of its own: it reads and parses batches
+// of records ahead while the caller hashes the ones before. The two files of
+// a pair are read this way, so they are inflated and parsed at the same time.
+// The interface is that of FastqReader, records are valid until the next
+// atEnd() or readRecord(). When the reading thread hits an error it stops,
+// and the error is thrown from readRecord() once the records before it are
+// read; atEnd() and readError() then report the state of the reader, as if
+// it had been read on the calling thread.
+
+class ThreadedFastqReader
+{
+  public:
+  typedef seqan::ConcurrentQueue<int, seqan::Suspendable<seqan::Limit> > TBatchQueue;
+
+  struct ReadThread
+  {
+    ThreadedFastqReader * reader;
+
+    void operator()();
+  };
+
+  ThreadedFastqReader();
+  ~ThreadedFastqReader();
+
+  bool open(const char * fileName, unsigned numThreads);
+  void close();
+
+  bool atEnd();
+  void readRecord(FastqRecord & record);
+
+  bool readError(const char * fileName);
+
+  private:
+  // Stops the reading thread, the batch being read stays valid.
+  void stop();
+
+  FastqReader reader;
+  std::vector<FastqBatch> batches;
+  int current; // the batch being read, -1 for none
+  TBatchQueue * readyQueue;
+  TBatchQueue * idleQueue;
+  seqan::Thread<ReadThread> * thread;
+};
+
+// -----------------------------------------------------------------------------
+// STRUCT Fastqinfo
+// -----------------------------------------------------------------------------
+
+// Options of the FASTQ checksum, see bamhash_checksum_fastq.
+struct Fastqinfo {
+  std::vector<std::string> fastqfiles;
+  bool debug;
+  bool noReadNames;
+  bool noQuality;
+  bool paired;
+  int threads;
+  int hashThreads;
+  int files;
+  HashFunction hash;
+  int sumBits;
+  std::string dumpHashes;
+  std::string dumpBuckets;
+  std::string bucketSums;
+  int bucketBits;
+  std::string iblt;
+  int ibltCells;
+  bool cache;
+  bool recompute;
+
+  Fastqinfo() : debug(false), noReadNames(false), noQuality(false), paired(true), threads(0), hashThreads(0), files(0), hash(HASH_MD5), sumBits(64), bucketBits(16), ibltCells(BAMHASH_IBLT_CELLS), cache(false), recompute(false) {}
+
+};
+
+// -----------------------------------------------------------------------------
+// FUNCTION hashFastqFiles()
+// -----------------------------------------------------------------------------
+
+// Hashes the reads of info.fastqfiles, taken two at a time as pairs unless
+// info.paired is false, into sum. count is the number of reads (pairs). In
+// debug mode the hashed strings are printed instead. Returns false on an
+// error, after printing it.
+bool hashFastqFiles(Fastqinfo const & info, Counts & sum, unsigned & count);
+
+#endif // BAMHASH_FASTQ_H
@@ -0,0 +1,1191 @@
+#include <algorithm>
+#include <string>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "bamhash_gzip.h"
+
+// Compressed bytes read past the end of a chunk at once, deflate blocks are
+// rarely longer.
+#define BAMHASH_GZIP_OVERSHOOT (1 << 20)
+
+// Chunks in flight per thread.
+#define BAMHASH_GZIP_JOBS_PER_THREAD 2
+
+// A guessed chunk start is given up when it inflates to more than this many
+// bytes per compressed byte; the chunk is then inflated again once the previous
+// one is settled.
+#define BAMHASH_GZIP_MAX_RATIO 64
+
+// Deflate back references reach at most 32 KB back. In the output of a chunk
+// that starts at a guessed position, a byte of the unknown window is written as
+// MARKER | (its index in the window).
+static const size_t WINDOW_SIZE = 32768;
+static const uint16_t MARKER = 0x8000;
+
+// -----------------------------------------------------------------------------
+// Compressed input
+// -----------------------------------------------------------------------------
+
+// A stretch of the compressed file, read with pread() so that all threads can
+// share one file descriptor. data[] is followed by 16 zero bytes.
+struct GzipInput
+{
+  int fd;
+  uint64_t fileSize;
+  uint64_t offset; // file offset of data[0]
+  size_t size;
+  std::vector<uint8_t> data;
+
+  GzipInput(int fd, uint64_t fileSize) : fd(fd), fileSize(fileSize), offset(0), size(0) {}
+
+  bool load(uint64_t from, size_t length) {
+    offset = from;
+    size = 0;
+    return extend(length);
+  }
+
+  // Appends the next length bytes of the file, false at the end of the file.
+  bool extend(size_t length) {
+    uint64_t from = offset + size;
+    if (from >= fileSize) {
+      data.resize(size + 16);
+      memset(&data[size], 0, 16);
+      return false;
+    }
+
+    length = std::min<uint64_t>(length, fileSize - from);
+    data.resize(size + length + 16);
+
+    for (size_t done = 0; done < length; ) {
+      ssize_t n = pread(fd, &data[size + done], length - done, from + done);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        length = done;
+        break;
+      }
+      done += n;
+    }
+
+    size += length;
+    memset(&data[size], 0, 16);
+    return length > 0;
+  }
+};
+
+namespace {
+
+// Reads the deflate stream LSB first. Past the end of the file it reads zeros,
+// counted in padding; the decoders give up once that gets out of hand.
+struct BitReader
+{
+  GzipInput & input;
+  size_t pos;       // next byte of input.data to load
+  uint64_t buf;     // bits not consumed yet
+  unsigned count;   // number of valid bits in buf
+  size_t padding;   // zero bytes loaded past the end of the file
+
+  BitReader(GzipInput & input, uint64_t bitPos) :
+    input(input), pos(bitPos / 8 - input.offset), buf(0), count(0), padding(0) {
+    refill();
+    consume(bitPos % 8);
+  }
+
+  uint64_t position() const {
+    return (input.offset + pos + padding) * 8 - count;
+  }
+
+  bool overrun() const {
+    return position() > input.fileSize * 8;
+  }
+
+  // Loads at least 56 bits.
+  void refill() {
+    if (pos + 8 > input.size && input.offset + input.size < input.fileSize) {
+      input.extend(BAMHASH_GZIP_OVERSHOOT);
+    }
+
+    if (pos + 8 <= input.size) {
+      uint64_t word;
+      memcpy(&word, &input.data[pos], 8);
+      buf |= word << count;
+      pos += (63 - count) >> 3;
+      count |= 56;
+      return;
+    }
+
+    while (count <= 56) {
+      uint64_t byte = 0;
+      if (pos < input.size) {
+        byte = input.data[pos++];
+      } else {
+        ++padding;
+      }
+      buf |= byte << count;
+      count += 8;
+    }
+  }
+
+  uint32_t peek(unsigned n) const {
+    return (uint32_t)(buf & ((1ull << n) - 1));
+  }
+
+  void consume(unsigned n) {
+    buf >>= n;
+    count -= n;
+  }
+
+  // Reads n <= 32 bits.
+  uint32_t bits(unsigned n) {
+    if (count < n) {
+      refill();
+    }
+    uint32_t value = peek(n);
+    consume(n);
+    return value;
+  }
+
+  void alignToByte() {
+    consume(count & 7);
+  }
+};
+
+// -----------------------------------------------------------------------------
+// Huffman decoding
+// -----------------------------------------------------------------------------
+
+// Two level decoding table. An entry is (symbol << 8) | code length, a zero
+// length marks an invalid code. Codes longer than ROOT_BITS go through a link
+// LINK | (subtable offset << 8) | subtable bits.
+static const unsigned ROOT_BITS = 10;
+static const uint32_t LINK = 0x80000000;
+
+static unsigned reverseBits(unsigned code, unsigned length) {
+  unsigned reversed = 0;
+  for (unsigned i = 0; i < length; ++i) {
+    reversed = (reversed << 1) | ((code >> i) & 1);
+  }
+  return reversed;
+}
+
+struct HuffmanTable
+{
+  std::vector<uint32_t> entries;
+
+  // Builds the table for the code lengths of n symbols. Like zlib, an
+  // incomplete code is only accepted when it has a single code of length one,
+  // and never for the code length code.
+  bool build(const uint8_t * lengths, unsigned n, bool codeLengthCode) {
+    unsigned count[16] = {0};
+    for (unsigned i = 0; i < n; ++i) {
+      ++count[lengths[i]];
+    }
+    count[0] = 0;
+
+    unsigned maxLength = 15;
+    while (maxLength > 0 && count[maxLength] == 0) {
+      --maxLength;
+    }
+
+    entries.assign(1u << ROOT_BITS, 0);
+    if (maxLength == 0) {
+      return true;
+    }
+
+    int left = 1;
+    for (unsigned length = 1; length < 16; ++length) {
+      left = (left << 1) - count[length];
+      if (left < 0) {
+        return false;
+      }
+    }
+    if (left > 0 && (codeLengthCode || maxLength != 1)) {
+      return false;
+    }
+
+    unsigned next[16];
+    unsigned code = 0;
+    for (unsigned length = 1; length < 16; ++length) {
+      code = (code + count[length - 1]) << 1;
+      next[length] = code;
+    }
+
+    uint16_t codes[320];
+    uint8_t subBits[1u << ROOT_BITS] = {0};
+    for (unsigned s = 0; s < n; ++s) {
+      unsigned length = lengths[s];
+      if (length == 0) {
+        continue;
+      }
+      codes[s] = reverseBits(next[length]++, length);
+      if (length > ROOT_BITS) {
+        uint8_t & bits = subBits[codes[s] & ((1u << ROOT_BITS) - 1)];
+        bits = std::max<uint8_t>(bits, length - ROOT_BITS);
+      }
+    }
+
+    for (unsigned prefix = 0; prefix < (1u << ROOT_BITS); ++prefix) {
+      if (subBits[prefix] != 0) {
+        entries[prefix] = LINK | (uint32_t)(entries.size() << 8) | subBits[prefix];
+        entries.resize(entries.size() + (1u << subBits[prefix]), 0);
+      }
+    }
+
+    for (unsigned s = 0; s < n; ++s) {
+      unsigned length = lengths[s];
+      if (length == 0) {
+        continue;
+      }
+      uint32_t entry = (s << 8) | length;
+      if (length <= ROOT_BITS) {
+        for (unsigned i = codes[s]; i < (1u << ROOT_BITS); i += 1u << length) {
+          entries[i] = entry;
+        }
+      } else {
+        uint32_t link = entries[codes[s] & ((1u << ROOT_BITS) - 1)];
+        uint32_t offset = (link >> 8) & 0xffff;
+        unsigned bits = link & 0xff;
+        for (unsigned i = codes[s] >> ROOT_BITS; i < (1u << bits); i += 1u << (length - ROOT_BITS)) {
+          entries[offset + i] = entry;
+        }
+      }
+    }
+    return true;
+  }
+
+  // Needs 15 bits in the reader, returns -1 for an invalid code.
+  int decode(BitReader & in) const {
+    uint32_t entry = entries[in.buf & ((1u << ROOT_BITS) - 1)];
+    if (entry & LINK) {
+      entry = entries[((entry >> 8) & 0xffff) + ((in.buf >> ROOT_BITS) & ((1u << (entry & 0xff)) - 1))];
+    }
+    unsigned length = entry & 0xff;
+    if (length == 0) {
+      return -1;
+    }
+    in.consume(length);
+    return (entry >> 8) & 0xffff;
+  }
+};
+
+struct FixedTables
+{
+  HuffmanTable literals;
+  HuffmanTable distances;
+
+  FixedTables() {
+    uint8_t lengths[288];
+    memset(lengths, 8, 144);
+    memset(lengths + 144, 9, 112);
+    memset(lengths + 256, 7, 24);
+    memset(lengths + 280, 8, 8);
+    literals.build(lengths, 288, false);
+    memset(lengths, 5, 32);
+    distances.build(lengths, 32, false);
+  }
+};
+
+static FixedTables const & fixedTables() {
+  static const FixedTables tables;
+  return tables;
+}
+
+static const uint16_t LENGTH_BASE[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t LENGTH_EXTRA[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t DISTANCE_BASE[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t DISTANCE_EXTRA[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// -----------------------------------------------------------------------------
+// Inflating deflate blocks
+// -----------------------------------------------------------------------------
+
+// Output of the inflater, either bytes or 16 bit symbols that can hold markers.
+template <typename TSymbol>
+struct InflateOutput
+{
+  std::vector<TSymbol> & data;
+  size_t size;
+  ptrdiff_t lowest;    // lowest position a back reference may reach
+
+  InflateOutput(std::vector<TSymbol> & data, ptrdiff_t lowest) :
+    data(data), size(0), lowest(lowest) {}
+
+  void reserve(size_t n) {
+    if (size + n > data.size()) {
+      data.resize(std::max(data.size() * 2, size + n));
+    }
+  }
+};
+
+static bool copyMatch(InflateOutput<uint8_t> & out, size_t distance, unsigned length) {
+  if ((ptrdiff_t)out.size - (ptrdiff_t)distance < out.lowest) {
+    return false;
+  }
+  out.reserve(length);
+  uint8_t * dst = &out.data[out.size];
+  const uint8_t * src = dst - distance;
+  if (distance >= length) {
+    memcpy(dst, src, length);
+  } else {
+    for (unsigned i = 0; i < length; ++i) {
+      dst[i] = src[i];
+    }
+  }
+  out.size += length;
+  return true;
+}
+
+static bool copyMatch(InflateOutput<uint16_t> & out, size_t distance, unsigned length) {
+  ptrdiff_t from = (ptrdiff_t)out.size - (ptrdiff_t)distance;
+  if (from < out.lowest) {
+    return false;
+  }
+  out.reserve(length);
+  uint16_t * dst = &out.data[out.size];
+  unsigned i = 0;
+  for (; from < 0 && i < length; ++i, ++from) {
+    dst[i] = (uint16_t)(MARKER | (from + WINDOW_SIZE));
+  }
+  const uint16_t * src = dst - distance;
+  if (distance >= length) {
+    memcpy(dst + i, src + i, (length - i) * sizeof(uint16_t));
+  } else {
+    for (; i < length; ++i) {
+      dst[i] = src[i];
+    }
+  }
+  out.size += length;
+  return true;
+}
+
+// True if the last n symbols of out hold a marker.
+static bool hasMarkers(InflateOutput<uint16_t> const & out, size_t n) {
+  const uint16_t * data = &out.data[out.size - n];
+  uint16_t any = 0;
+  for (size_t i = 0; i < n; ++i) {
+    any |= data[i];
+  }
+  return (any & MARKER) != 0;
+}
+
+static inline bool isText(unsigned c) {
+  return (c >= 32 && c < 127) || c == '\n' || c == '\r' || c == '\t';
+}
+
+struct DynamicTables
+{
+  HuffmanTable codes;
+  HuffmanTable literals;
+  HuffmanTable distances;
+};
+
+static bool readDynamicTables(BitReader & in, DynamicTables & tables) {
+  static const uint8_t ORDER[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+  unsigned numLiterals = in.bits(5) + 257;
+  unsigned numDistances = in.bits(5) + 1;
+  unsigned numCodes = in.bits(4) + 4;
+  if (numLiterals > 286 || numDistances > 30) {
+    return false;
+  }
+
+  uint8_t lengths[320] = {0};
+  for (unsigned i = 0; i < numCodes; ++i) {
+    lengths[ORDER[i]] = in.bits(3);
+  }
+  if (!tables.codes.build(lengths, 19, true)) {
+    return false;
+  }
+
+  unsigned total = numLiterals + numDistances;
+  for (unsigned n = 0; n < total; ) {
+    if (in.count < 32) {
+      in.refill();
+    }
+    int symbol = tables.codes.decode(in);
+    if (symbol < 0) {
+      return false;
+    }
+    if (symbol < 16) {
+      lengths[n++] = symbol;
+      continue;
+    }
+
+    unsigned repeat;
+    uint8_t value = 0;
+    if (symbol == 16) {
+      if (n == 0) {
+        return false;
+      }
+      value = lengths[n - 1];
+      repeat = 3 + in.bits(2);
+    } else if (symbol == 17) {
+      repeat = 3 + in.bits(3);
+    } else {
+      repeat = 11 + in.bits(7);
+    }
+    if (n + repeat > total) {
+      return false;
+    }
+    memset(lengths + n, value, repeat);
+    n += repeat;
+  }
+
+  // a block needs its end of block code
+  if (lengths[256] == 0) {
+    return false;
+  }
+
+  return tables.literals.build(lengths, numLiterals, false) &&
+         tables.distances.build(lengths + numLiterals, numDistances, false);
+}
+
+enum { BLOCK_DONE, BLOCK_FINAL, BLOCK_ERROR };
+
+// Inflates one deflate block. With textOnly, literals other than printable
+// ASCII and whitespace are treated as errors.
+template <typename TSymbol>
+static int inflateBlock(BitReader & in, InflateOutput<TSymbol> & out, DynamicTables & dynamic, bool textOnly) {
+  unsigned header = in.bits(3);
+  bool final = header & 1;
+  HuffmanTable const * literals;
+  HuffmanTable const * distances;
+
+  switch (header >> 1) {
+    case 0: {
+      in.alignToByte();
+      unsigned length = in.bits(16);
+      if (length != (~in.bits(16) & 0xffff)) {
+        return BLOCK_ERROR;
+      }
+      out.reserve(length);
+      for (unsigned i = 0; i < length; ++i) {
+        unsigned c = in.bits(8);
+        if (textOnly && !isText(c)) {
+          return BLOCK_ERROR;
+        }
+        out.data[out.size++] = c;
+      }
+      return in.padding > 16 ? BLOCK_ERROR : (final ? BLOCK_FINAL : BLOCK_DONE);
+    }
+    case 1:
+      literals = &fixedTables().literals;
+      distances = &fixedTables().distances;
+      break;
+    case 2:
+      if (!readDynamicTables(in, dynamic)) {
+        return BLOCK_ERROR;
+      }
+      literals = &dynamic.literals;
+      distances = &dynamic.distances;
+      break;
+    default:
+      return BLOCK_ERROR;
+  }
+
+  for (;;) {
+    // a length/distance pair takes at most 48 bits
+    if (in.count < 48) {
+      in.refill();
+      if (in.padding > 16) {
+        return BLOCK_ERROR;
+      }
+    }
+
+    int symbol = literals->decode(in);
+    if (symbol < 256) {
+      if (symbol < 0 || (textOnly && !isText(symbol))) {
+        return BLOCK_ERROR;
+      }
+      out.reserve(1);
+      out.data[out.size++] = symbol;
+      continue;
+    }
+    if (symbol == 256) {
+      break;
+    }
+
+    symbol -= 257;
+    if (symbol >= 29) {
+      return BLOCK_ERROR;
+    }
+    unsigned length = LENGTH_BASE[symbol] + in.bits(LENGTH_EXTRA[symbol]);
+
+    symbol = distances->decode(in);
+    if (symbol < 0 || symbol >= 30) {
+      return BLOCK_ERROR;
+    }
+    size_t distance = DISTANCE_BASE[symbol] + in.bits(DISTANCE_EXTRA[symbol]);
+
+    if (!copyMatch(out, distance, length)) {
+      return BLOCK_ERROR;
+    }
+  }
+
+  return final ? BLOCK_FINAL : BLOCK_DONE;
+}
+
+// Skips a gzip member header.
+static bool readGzipHeader(BitReader & in) {
+  if (in.bits(8) != 0x1f || in.bits(8) != 0x8b || in.bits(8) != 8) {
+    return false;
+  }
+
+  unsigned flags = in.bits(8);
+  in.bits(32); // modification time
+  in.bits(16); // extra flags and OS
+
+  if (flags & 4) {
+    for (unsigned length = in.bits(16); length > 0; --length) {
+      in.bits(8);
+    }
+  }
+  // file name and comment
+  for (unsigned flag = 8; flag <= 16; flag <<= 1) {
+    if (flags & flag) {
+      while (in.bits(8) != 0 && !in.overrun()) {}
+    }
+  }
+  if (flags & 2) {
+    in.bits(16); // header CRC
+  }
+
+  return !in.overrun();
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+// STRUCT GzipChunk
+// -----------------------------------------------------------------------------
+
+// End of a gzip member inside the output of a chunk.
+struct GzipMember
+{
+  size_t end;
+  uint32_t crc;
+  uint32_t size;
+};
+
+// The inflated output of one chunk: head holds the symbols written while back
+// references could still reach into the unknown window, tail the bytes after
+// that. tail[0..tailStart) is a copy of the window, not output. Once the window
+// is known, head is resolved into resolved[] and crcs[i] is the CRC32 of the
+// output between member end i - 1 and member end i (the last one runs to the
+// end of the chunk).
+struct GzipChunk
+{
+  std::vector<uint16_t> head;
+  size_t headSize;
+  std::vector<uint8_t> tail;
+  size_t tailStart;
+  size_t tailSize;
+  std::vector<GzipMember> members;
+
+  uint64_t startBit;    // first block
+  uint64_t stopBit;     // stop at the first dynamic block from here on
+  uint64_t endBit;      // where it stopped
+  bool eof;             // reached the end of the gzip stream
+  bool ok;
+  const char * error;
+
+  std::vector<char> window; // the 32 KB before the chunk
+  std::vector<char> resolved;
+  std::vector<uint32_t> crcs;
+
+  DynamicTables tables;
+  std::vector<uint16_t> trial;
+
+  GzipChunk() :
+    head(1 << 16), headSize(0), tail(1 << 20), tailStart(0), tailSize(0),
+    startBit(0), stopBit(0), endBit(0), eof(false), ok(false), error(NULL),
+    resolved(1), trial(1 << 16) {}
+
+  size_t outputSize() const {
+    return headSize + tailSize - tailStart;
+  }
+
+  const char * tailBegin() const {
+    return reinterpret_cast<const char *>(&tail[0]) + tailStart;
+  }
+};
+
+namespace {
+
+static bool failChunk(GzipChunk & chunk, const char * error) {
+  chunk.ok = false;
+  chunk.error = error;
+  return false;
+}
+
+// Inflates from the block at start, or from the member header at start, up to
+// the first dynamic block at or after chunk.stopBit or to the end of the gzip
+// stream. With window == NULL the bytes before start are unknown and references
+// to them are written as markers; maxOutput then bounds the output.
+static bool inflateChunk(GzipChunk & chunk, GzipInput & input, uint64_t start, bool header,
+                         std::vector<char> const * window, size_t maxOutput) {
+  chunk.startBit = start;
+  chunk.members.clear();
+  chunk.eof = false;
+  chunk.headSize = 0;
+  chunk.tailStart = 0;
+  chunk.tailSize = 0;
+  chunk.error = NULL;
+
+  bool markers = (window == NULL);
+  InflateOutput<uint16_t> head(chunk.head, -(ptrdiff_t)WINDOW_SIZE);
+  InflateOutput<uint8_t> tail(chunk.tail, 0);
+
+  if (!markers) {
+    tail.reserve(window->size());
+    std::copy(window->begin(), window->end(), tail.data.begin());
+    tail.size = chunk.tailStart = window->size();
+  }
+
+  BitReader in(input, start);
+  if (header && !readGzipHeader(in)) {
+    return failChunk(chunk, "not in gzip format");
+  }
+
+  for (;;) {
+    if (in.count < 3) {
+      in.refill();
+    }
+    if (in.position() >= chunk.stopBit && (in.peek(3) >> 1) == 2) {
+      break;
+    }
+
+    int status;
+    if (markers) {
+      status = inflateBlock(in, head, chunk.tables, false);
+
+      // no markers left in the last 32 KB, continue with bytes
+      if (status != BLOCK_ERROR && head.size >= WINDOW_SIZE && !hasMarkers(head, WINDOW_SIZE)) {
+        markers = false;
+        tail.reserve(WINDOW_SIZE);
+        for (size_t i = 0; i < WINDOW_SIZE; ++i) {
+          tail.data[i] = (uint8_t)head.data[head.size - WINDOW_SIZE + i];
+        }
+        tail.size = chunk.tailStart = WINDOW_SIZE;
+        tail.lowest = std::max<ptrdiff_t>(0, head.lowest - (ptrdiff_t)(head.size - WINDOW_SIZE));
+      }
+      if (maxOutput != 0 && head.size > maxOutput) {
+        return failChunk(chunk, "guessed block start inflates too far");
+      }
+    } else {
+      status = inflateBlock(in, tail, chunk.tables, false);
+      if (maxOutput != 0 && head.size + tail.size > maxOutput) {
+        return failChunk(chunk, "guessed block start inflates too far");
+      }
+    }
+
+    if (status == BLOCK_ERROR || in.overrun()) {
+      return failChunk(chunk, "invalid or truncated deflate data");
+    }
+    if (status == BLOCK_DONE) {
+      continue;
+    }
+
+    // end of a member, read its trailer
+    in.alignToByte();
+    GzipMember member;
+    member.crc = in.bits(32);
+    member.size = in.bits(32);
+    member.end = head.size + tail.size - chunk.tailStart;
+    if (in.overrun()) {
+      return failChunk(chunk, "unexpected end of file");
+    }
+    chunk.members.push_back(member);
+
+    // like gzip, ignore anything but another member after the end
+    in.refill();
+    if (in.position() >= input.fileSize * 8 || in.peek(16) != 0x8b1f) {
+      chunk.eof = true;
+      break;
+    }
+    if (!readGzipHeader(in)) {
+      return failChunk(chunk, "invalid gzip member header");
+    }
+    if (markers) {
+      head.lowest = head.size;
+    } else {
+      tail.lowest = tail.size;
+    }
+  }
+
+  chunk.endBit = in.position();
+  chunk.headSize = head.size;
+  chunk.tailSize = markers ? chunk.tailStart : tail.size;
+  chunk.ok = true;
+  return true;
+}
+
+static inline uint64_t bitsAt(std::vector<uint8_t> const & data, uint64_t bit) {
+  uint64_t word;
+  memcpy(&word, &data[bit / 8], 8);
+  return word >> (bit % 8);
+}
+
+// Returns the first position in [from, to) that passes as the start of a
+// dynamic block whose first block inflates to text, or to if there is none.
+static uint64_t findBlock(GzipChunk & chunk, GzipInput & input, uint64_t from, uint64_t to) {
+  for (uint64_t bit = from; bit < to; ++bit) {
+    uint64_t rel = bit - input.offset * 8;
+    uint64_t header = bitsAt(input.data, rel);
+
+    // dynamic block, at most 286 literal/length and 30 distance codes
+    if (((header >> 1) & 3) != 2 || ((header >> 3) & 31) > 29 || ((header >> 8) & 31) > 29) {
+      continue;
+    }
+
+    // the code length code has to be complete
+    unsigned numCodes = ((header >> 13) & 15) + 4;
+    uint64_t lengths = bitsAt(input.data, rel + 17);
+    unsigned kraft = 0;
+    for (unsigned i = 0; i < numCodes; ++i) {
+      unsigned length = (lengths >> (3 * i)) & 7;
+      if (length != 0) {
+        kraft += 128 >> length;
+      }
+    }
+    if (kraft != 128) {
+      continue;
+    }
+
+    BitReader in(input, bit);
+    InflateOutput<uint16_t> out(chunk.trial, -(ptrdiff_t)WINDOW_SIZE);
+    if (inflateBlock(in, out, chunk.tables, true) != BLOCK_ERROR && !in.overrun()) {
+      return bit;
+    }
+  }
+  return to;
+}
+
+// Inflates chunk number index of the file. Every chunk but the first starts at
+// a guessed block.
+static void inflateGuess(GzipChunk & chunk, GzipInput & input, uint64_t index, uint64_t numChunks) {
+  uint64_t start = index * BAMHASH_GZIP_CHUNK;
+  uint64_t end = std::min<uint64_t>(start + BAMHASH_GZIP_CHUNK, input.fileSize);
+  chunk.stopBit = (index + 1 < numChunks) ? end * 8 : UINT64_MAX;
+  chunk.ok = false;
+
+  if (!input.load(start, BAMHASH_GZIP_CHUNK + BAMHASH_GZIP_OVERSHOOT)) {
+    failChunk(chunk, "read error");
+    return;
+  }
+
+  if (index == 0) {
+    chunk.window.clear();
+    inflateChunk(chunk, input, 0, true, &chunk.window, 0);
+    return;
+  }
+
+  uint64_t block = findBlock(chunk, input, start * 8, end * 8);
+  if (block == end * 8) {
+    failChunk(chunk, "no block start found");
+    return;
+  }
+
+  inflateChunk(chunk, input, block, false, NULL, (size_t)BAMHASH_GZIP_CHUNK * BAMHASH_GZIP_MAX_RATIO);
+}
+
+// Resolves the markers in head[from, to) with the window before the chunk,
+// given as a full 32 KB array.
+static void resolveHead(GzipChunk & chunk, const char * window, size_t from, size_t to) {
+  const uint16_t * head = &chunk.head[0];
+  char * out = &chunk.resolved[0];
+
+  size_t i = from;
+  for (; i + 16 <= to; i += 16) {
+    uint16_t any = 0;
+    for (size_t j = 0; j < 16; ++j) {
+      any |= head[i + j];
+    }
+
+    if (any & MARKER) {
+      for (size_t j = i; j < i + 16; ++j) {
+        out[j] = (head[j] & MARKER) ? window[head[j] & ~MARKER] : (char)head[j];
+      }
+    } else {
+      for (size_t j = i; j < i + 16; ++j) {
+        out[j] = (char)head[j];
+      }
+    }
+  }
+  for (; i < to; ++i) {
+    out[i] = (head[i] & MARKER) ? window[head[i] & ~MARKER] : (char)head[i];
+  }
+}
+
+// Copies output [from, to) of a chunk whose head has been resolved to dst.
+static void copyOutput(char * dst, GzipChunk const & chunk, size_t from, size_t to) {
+  if (from < chunk.headSize) {
+    size_t end = std::min(to, chunk.headSize);
+    std::copy(chunk.resolved.begin() + from, chunk.resolved.begin() + end, dst);
+    dst += end - from;
+    from = end;
+  }
+  if (from < to) {
+    std::copy(chunk.tailBegin() + (from - chunk.headSize), chunk.tailBegin() + (to - chunk.headSize), dst);
+  }
+}
+
+static uint32_t crcOutput(GzipChunk const & chunk, size_t from, size_t to) {
+  uint32_t crc = crc32(0, NULL, 0);
+  if (from < chunk.headSize) {
+    size_t end = std::min(to, chunk.headSize);
+    crc = crc32(crc, (const Bytef *)&chunk.resolved[from], end - from);
+    from = end;
+  }
+  if (from < to) {
+    crc = crc32(crc, (const Bytef *)chunk.tailBegin() + (from - chunk.headSize), to - from);
+  }
+  return crc;
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+// CLASS ParallelGzipStreambuf
+// -----------------------------------------------------------------------------
+
+ParallelGzipStreambuf::Job::Job() :
+  chunk(new GzipChunk),
+  readyEvent(cs),
+  ready(true)
+{}
+
+ParallelGzipStreambuf::Job::~Job()
+{
+  delete chunk;
+}
+
+void ParallelGzipStreambuf::InflateThread::operator()()
+{
+  seqan::ScopedReadLock<TJobQueue> readLock(streamBuf->todoQueue);
+  seqan::ScopedWriteLock<TJobQueue> writeLock(streamBuf->runningQueue);
+
+  GzipInput input(streamBuf->fd, streamBuf->fileSize);
+
+  while (true)
+  {
+    int jobId = -1;
+    if (!popFront(jobId, streamBuf->todoQueue))
+      return;
+
+    Job & job = streamBuf->jobs[jobId];
+    uint64_t index;
+
+    // chunks are queued in file order
+    {
+      seqan::ScopedLock<seqan::Mutex> lock(streamBuf->chunkLock);
+      if (streamBuf->stopped || streamBuf->nextChunkIndex == streamBuf->numChunks)
+        return;
+      index = streamBuf->nextChunkIndex++;
+      job.ready = false;
+      appendValue(streamBuf->runningQueue, jobId);
+    }
+
+    inflateGuess(*job.chunk, input, index, streamBuf->numChunks);
+    streamBuf->settle(*job.chunk, input, index);
+
+    {
+      seqan::ScopedLock<seqan::CriticalSection> lock(job.cs);
+      job.ready = true;
+      seqan::signal(job.readyEvent);
+    }
+  }
+}
+
+ParallelGzipStreambuf::ParallelGzipStreambuf(const char * fileName, unsigned numThreads_) :
+  fd(-1),
+  fileSize(0),
+  numChunks(0),
+  chunkLock(false),
+  nextChunkIndex(0),
+  stopped(false),
+  numThreads(std::max(numThreads_, 1u)),
+  jobs(numThreads * BAMHASH_GZIP_JOBS_PER_THREAD),
+  runningQueue(jobs.size()),
+  todoQueue(jobs.size()),
+  currentJobId(-1),
+  threads(NULL),
+  settleEvent(settleCs),
+  settledCount(0),
+  settledEnd(0),
+  settledEof(false),
+  settledError(NULL),
+  current(NULL),
+  crc(crc32(0, NULL, 0)),
+  memberSize(0),
+  segment(0),
+  done(false)
+{
+  fd = ::open(fileName, O_RDONLY);
+  if (fd == -1)
+    return;
+
+  // chunks are read at their offsets, which needs a regular file
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+  {
+    ::close(fd);
+    fd = -1;
+    return;
+  }
+
+  fileSize = st.st_size;
+  numChunks = (fileSize + BAMHASH_GZIP_CHUNK - 1) / BAMHASH_GZIP_CHUNK;
+
+  lockReading(runningQueue);
+  lockWriting(todoQueue);
+  setReaderWriterCount(runningQueue, 1, numThreads);
+  setReaderWriterCount(todoQueue, numThreads, 1);
+
+  for (int i = 0; i < (int)jobs.size(); ++i)
+    appendValue(todoQueue, i);
+
+  threads = new seqan::Thread<InflateThread>[numThreads];
+  for (unsigned i = 0; i < numThreads; ++i)
+  {
+    threads[i].worker.streamBuf = this;
+    run(threads[i]);
+  }
+}
+
+ParallelGzipStreambuf::~ParallelGzipStreambuf()
+{
+  if (threads != NULL)
+  {
+    {
+      seqan::ScopedLock<seqan::Mutex> lock(chunkLock);
+      stopped = true;
+    }
+
+    unlockWriting(todoQueue);
+    unlockReading(runningQueue);
+
+    for (unsigned i = 0; i < numThreads; ++i)
+      waitFor(threads[i]);
+    delete[] threads;
+  }
+
+  if (fd != -1)
+    ::close(fd);
+}
+
+// Waits until the chunks before chunk number index are settled, inflates the
+// chunk again from where the previous one stopped if the guess was wrong, and
+// resolves its markers. The last 32 KB go first so that the next chunk can
+// settle while the rest is resolved and checksummed.
+void ParallelGzipStreambuf::settle(GzipChunk & chunk, GzipInput & input, uint64_t index)
+{
+  uint64_t start;
+  bool eof;
+  const char * error;
+  {
+    seqan::ScopedLock<seqan::CriticalSection> lock(settleCs);
+    while (settledCount != index)
+      seqan::waitFor(settleEvent);
+    start = settledEnd;
+    eof = settledEof;
+    error = settledError;
+    chunk.window = settledWindow;
+  }
+
+  if (eof || error != NULL)
+  {
+    // nothing left to inflate, pass the state on
+    chunk.ok = (error == NULL);
+    chunk.error = error;
+    chunk.eof = true;
+  }
+  else if (!chunk.ok || chunk.startBit != start)
+  {
+    input.load(start / 8, BAMHASH_GZIP_CHUNK + BAMHASH_GZIP_OVERSHOOT);
+    inflateChunk(chunk, input, start, start == 0, &chunk.window, 0);
+  }
+
+  if (eof || !chunk.ok)
+  {
+    seqan::ScopedLock<seqan::CriticalSection> lock(settleCs);
+    settledCount = index + 1;
+    settledEof = chunk.eof;
+    settledError = chunk.error;
+    seqan::signal(settleEvent);
+    return;
+  }
+
+  // the window, aligned to the end of a full 32 KB. References to bytes before
+  // the start of the file read zeros, the CRC check catches those.
+  char full[WINDOW_SIZE];
+  memset(full, 0, WINDOW_SIZE - chunk.window.size());
+  std::copy(chunk.window.begin(), chunk.window.end(), full + WINDOW_SIZE - chunk.window.size());
+
+  size_t headSize = chunk.headSize;
+  size_t split = headSize > WINDOW_SIZE ? headSize - WINDOW_SIZE : 0;
+  chunk.resolved.resize(std::max<size_t>(headSize, 1));
+  resolveHead(chunk, full, split, headSize);
+
+  // the window of the next chunk
+  size_t size = chunk.outputSize();
+  std::vector<char> window;
+  if (size >= WINDOW_SIZE)
+  {
+    window.resize(WINDOW_SIZE);
+    copyOutput(&window[0], chunk, size - WINDOW_SIZE, size);
+  }
+  else
+  {
+    size_t keep = std::min(chunk.window.size(), WINDOW_SIZE - size);
+    window.assign(chunk.window.end() - keep, chunk.window.end());
+    window.resize(keep + size);
+    copyOutput(&window[0] + keep, chunk, 0, size);
+  }
+
+  {
+    seqan::ScopedLock<seqan::CriticalSection> lock(settleCs);
+    settledCount = index + 1;
+    settledEnd = chunk.endBit;
+    settledEof = chunk.eof;
+    settledWindow.swap(window);
+    seqan::signal(settleEvent);
+  }
+
+  resolveHead(chunk, full, 0, split);
+
+  // CRC32 of every member end and of the rest, combined on the reading thread
+  chunk.crcs.clear();
+  size_t from = 0;
+  for (size_t i = 0; i < chunk.members.size(); ++i)
+  {
+    chunk.crcs.push_back(crcOutput(chunk, from, chunk.members[i].end));
+    from = chunk.members[i].end;
+  }
+  chunk.crcs.push_back(crcOutput(chunk, from, size));
+}
+
+bool ParallelGzipStreambuf::fail(const char * message)
+{
+  errorMessage = message;
+  done = true;
+  seqan::ScopedLock<seqan::Mutex> lock(chunkLock);
+  stopped = true;
+  return false;
+}
+
+bool ParallelGzipStreambuf::nextChunk()
+{
+  if (currentJobId >= 0)
+    appendValue(todoQueue, currentJobId);
+  currentJobId = -1;
+  current = NULL;
+
+  if (done)
+    return false;
+
+  if (!popFront(currentJobId, runningQueue))
+  {
+    currentJobId = -1;
+    return fail("unexpected end of file");
+  }
+
+  Job & job = jobs[currentJobId];
+  {
+    seqan::ScopedLock<seqan::CriticalSection> lock(job.cs);
+    while (!job.ready)
+      seqan::waitFor(job.readyEvent);
+  }
+
+  GzipChunk & chunk = *job.chunk;
+  if (!chunk.ok)
+    return fail(chunk.error);
+
+  // check the members that end in this chunk
+  size_t size = chunk.outputSize();
+  size_t from = 0;
+  for (size_t i = 0; i < chunk.members.size(); ++i)
+  {
+    GzipMember const & member = chunk.members[i];
+    crc = crc32_combine(crc, chunk.crcs[i], member.end - from);
+    memberSize += member.end - from;
+    if (crc != member.crc || memberSize != member.size)
+      return fail("CRC or length mismatch");
+    crc = crc32(0, NULL, 0);
+    memberSize = 0;
+    from = member.end;
+  }
+  crc = crc32_combine(crc, chunk.crcs.back(), size - from);
+  memberSize += size - from;
+
+  if (chunk.eof)
+  {
+    done = true;
+    seqan::ScopedLock<seqan::Mutex> lock(chunkLock);
+    stopped = true;
+  }
+
+  current = &chunk;
+  segment = 0;
+  this->setg(&chunk.resolved[0], &chunk.resolved[0], &chunk.resolved[0] + chunk.headSize);
+  return true;
+}
+
+ParallelGzipStreambuf::int_type ParallelGzipStreambuf::underflow()
+{
+  while (this->gptr() == this->egptr())
+  {
+    if (current != NULL && segment == 0)
+    {
+      // after the resolved head comes the tail
+      char * tail = reinterpret_cast<char *>(&current->tail[0]);
+      this->setg(tail + current->tailStart, tail + current->tailStart, tail + current->tailSize);
+      segment = 1;
+      continue;
+    }
+
+    if (!nextChunk())
+      return traits_type::eof();
+  }
+
+  return traits_type::to_int_type(*this->gptr());
+}
+
+// Reads the first n bytes of the file, false if it is shorter.
+static bool readMagic(const char * fileName, unsigned char * magic, size_t n)
+{
+  FILE * file = fopen(fileName, "rb");
+  if (file == NULL)
+    return false;
+  size_t got = fread(magic, 1, n, file);
+  fclose(file);
+  return got == n;
+}
+
+bool isGzipFile(const char * fileName)
+{
+  unsigned char magic[3];
+  return readMagic(fileName, magic, 3) && magic[0] == 0x1f && magic[1] == 0x8b && magic[2] == 8;
+}
+
+bool isBgzfFile(const char * fileName)
+{
+  // gzip header with an extra field that starts with the "BC" subfield
+  unsigned char magic[14];
+  return readMagic(fileName, magic, 14) && magic[0] == 0x1f && magic[1] == 0x8b && magic[2] == 8 &&
+         (magic[3] & 4) && magic[12] == 'B' && magic[13] == 'C';
+}
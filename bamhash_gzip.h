@@ -0,0 +1,130 @@
+#ifndef BAMHASH_GZIP_H
+#define BAMHASH_GZIP_H
+
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <seqan/basic.h>
+#include <seqan/parallel.h>
+#include <seqan/system.h>
+
+// -----------------------------------------------------------------------------
+// CLASS ParallelGzipStreambuf
+// -----------------------------------------------------------------------------
+
+// Inflates an ordinary gzip file (one or more members, as written by gzip or
+// pigz) on several threads.
+//
+// The compressed file is cut into chunks of BAMHASH_GZIP_CHUNK bytes. The
+// first chunk is inflated from the gzip header. For every other chunk a worker
+// searches for the first position that looks like the start of a dynamic
+// Huffman deflate block and inflates from there without knowing the 32 KB
+// window that precedes it: back references into the unknown window are kept
+// as markers. Every chunk stops at the first dynamic block at or after the start
+// of the next chunk, so a guessed start is only used if it is exactly where the
+// previous chunk stopped; if not, the worker inflates the chunk again from
+// there. Once the last 32 KB of the previous chunk are known, the worker
+// resolves its markers, hands its own last 32 KB on to the next chunk and
+// computes the CRC32 of its output. The reading thread only combines the CRCs
+// to check every member.
+//
+// Guessed starts are only accepted when their first block decodes to text, so
+// this is meant for FASTQ and FASTA. Other data is still inflated correctly,
+// just without the speedup. BGZF files are better read with seqan's
+// basic_unbgzf_streambuf, whose blocks can be inflated independently.
+
+#define BAMHASH_GZIP_CHUNK (4 << 20)
+
+struct GzipChunk;
+struct GzipInput;
+
+class ParallelGzipStreambuf : public std::streambuf
+{
+  public:
+  typedef seqan::ConcurrentQueue<int, seqan::Suspendable<seqan::Limit> > TJobQueue;
+
+  struct Job
+  {
+    GzipChunk * chunk;
+
+    seqan::CriticalSection cs;
+    seqan::Condition readyEvent;
+    bool ready;
+
+    Job();
+    ~Job();
+  };
+
+  struct InflateThread
+  {
+    ParallelGzipStreambuf * streamBuf;
+
+    void operator()();
+  };
+
+  ParallelGzipStreambuf(const char * fileName, unsigned numThreads);
+  ~ParallelGzipStreambuf();
+
+  bool isOpen() const
+  {
+    return fd != -1;
+  }
+
+  // Broken gzip data ends the stream early, this says why.
+  std::string const & error() const
+  {
+    return errorMessage;
+  }
+
+  protected:
+  int_type underflow();
+
+  private:
+  bool nextChunk();
+  bool fail(const char * message);
+  void settle(GzipChunk & chunk, GzipInput & input, uint64_t index);
+
+  int fd;
+  uint64_t fileSize;
+  uint64_t numChunks;
+
+  // handing out chunks to the workers, in order
+  seqan::Mutex chunkLock;
+  uint64_t nextChunkIndex;
+  bool stopped;
+
+  unsigned numThreads;
+  std::vector<Job> jobs;
+  TJobQueue runningQueue;
+  TJobQueue todoQueue;
+  int currentJobId;
+  seqan::Thread<InflateThread> * threads;
+
+  // chunks are settled in order: the first settledCount chunks are inflated
+  // from the right position and the window after them is known
+  seqan::CriticalSection settleCs;
+  seqan::Condition settleEvent;
+  uint64_t settledCount;
+  uint64_t settledEnd;
+  bool settledEof;
+  const char * settledError;
+  std::vector<char> settledWindow;
+
+  // state of the reading thread
+  GzipChunk * current;
+  uint32_t crc;
+  uint32_t memberSize;
+  int segment;
+  bool done;
+  std::string errorMessage;
+};
+
+// True if the file starts with the gzip magic number.
+bool isGzipFile(const char * fileName);
+
+// True if the file starts with a BGZF block, as written by bgzip.
+bool isBgzfFile(const char * fileName);
+
+#endif // BAMHASH_GZIP_H
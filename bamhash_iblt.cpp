@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+
+#include "bamhash_iblt.h"
+
+// The finalizer of splitmix64, spreads every bit of x over the result.
+static inline uint64_t mix64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+// Tells a cell with a single hash from one whose hashes only sum up like one.
+static inline uint64_t ibltCheck(hash_t hash) {
+  return mix64(hash.p.high ^ mix64(hash.p.low));
+}
+
+// The inverse of an odd number mod 2^64, by Newton's method.
+static inline uint64_t inverse(uint64_t a) {
+  uint64_t x = a;
+  for (int i = 0; i < 5; i++) {
+    x *= 2 - a * x;
+  }
+  return x;
+}
+
+// Orders entries by their hash, as bamhash_diff prints them.
+static inline bool lessEntry(IbltEntry const & a, IbltEntry const & b) {
+  return a.hash.p.high < b.hash.p.high || (a.hash.p.high == b.hash.p.high && a.hash.p.low < b.hash.p.low);
+}
+
+Iblt::Iblt(unsigned numCells) :
+  cells((numCells + BAMHASH_IBLT_HASHES - 1) / BAMHASH_IBLT_HASHES * BAMHASH_IBLT_HASHES)
+{}
+
+size_t Iblt::cell(hash_t hash, unsigned i) const
+{
+  // the i-th third of the table, indexed by the top bits of a product
+  size_t part = cells.size() / BAMHASH_IBLT_HASHES;
+  uint64_t x = mix64(hash.p.low + (i + 1) * 0x9e3779b97f4a7c15ULL) ^ hash.p.high;
+  return i * part + (size_t)(((unsigned __int128)x * part) >> 64);
+}
+
+void Iblt::add(hash_t hash, int64_t count)
+{
+  uint64_t check = ibltCheck(hash);
+  for (unsigned i = 0; i < BAMHASH_IBLT_HASHES; ++i)
+  {
+    IbltCell & c = cells[cell(hash, i)];
+    c.count += count;
+    c.low += hash.p.low * count;
+    c.high += hash.p.high * count;
+    c.check += check * count;
+  }
+}
+
+void Iblt::add(hash_t hash)
+{
+  if (!cells.empty())
+    add(hash, 1);
+}
+
+void Iblt::add(HashBatch const & batch)
+{
+  if (cells.empty())
+    return;
+  for (size_t i = 0; i < batch.size; ++i)
+    add(batch.hashes[i], 1);
+}
+
+void Iblt::add(Iblt const & other, int sign)
+{
+  for (size_t i = 0; i < cells.size() && i < other.cells.size(); ++i)
+  {
+    cells[i].count += other.cells[i].count * sign;
+    cells[i].low += other.cells[i].low * sign;
+    cells[i].high += other.cells[i].high * sign;
+    cells[i].check += other.cells[i].check * sign;
+  }
+}
+
+bool Iblt::pure(size_t at, IbltEntry & entry) const
+{
+  IbltCell const & c = cells[at];
+  if (c.count == 0)
+    return false;
+
+  // A hash that is n = 2^twos * odd times more in one table leaves n times
+  // its sums, which lose the top twos bits of the hash. Those are tried.
+  uint64_t n = (uint64_t)c.count;
+  unsigned twos = 0;
+  while ((n & 1) == 0)
+  {
+    n >>= 1;
+    ++twos;
+  }
+  uint64_t mask = ((uint64_t)1 << twos) - 1;
+  if (twos > BAMHASH_IBLT_MAX_TWOS || (c.low & mask) != 0 || (c.high & mask) != 0)
+    return false;
+
+  uint64_t inv = inverse(n);
+  uint64_t low = (c.low >> twos) * inv;
+  uint64_t high = (c.high >> twos) * inv;
+  if (twos > 0)
+  {
+    low &= ~(uint64_t)0 >> twos;
+    high &= ~(uint64_t)0 >> twos;
+  }
+
+  entry.count = c.count;
+  for (uint64_t lowTop = 0; lowTop <= mask; ++lowTop)
+  {
+    for (uint64_t highTop = 0; highTop <= mask; ++highTop)
+    {
+      entry.hash.p.low = twos == 0 ? low : low | lowTop << (64 - twos);
+      entry.hash.p.high = twos == 0 ? high : high | highTop << (64 - twos);
+      if (ibltCheck(entry.hash) * (uint64_t)c.count != c.check)
+        continue;
+      for (unsigned i = 0; i < BAMHASH_IBLT_HASHES; ++i)
+      {
+        if (cell(entry.hash, i) == at)
+          return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool Iblt::decode(std::vector<IbltEntry> & entries) const
+{
+  Iblt table(*this);
+  entries.clear();
+
+  std::vector<size_t> todo(cells.size());
+  for (size_t i = 0; i < todo.size(); ++i)
+    todo[i] = i;
+
+  while (!todo.empty())
+  {
+    size_t at = todo.back();
+    todo.pop_back();
+
+    IbltEntry entry;
+    if (!table.pure(at, entry))
+      continue;
+
+    entries.push_back(entry);
+    table.add(entry.hash, -entry.count);
+    for (unsigned i = 0; i < BAMHASH_IBLT_HASHES; ++i)
+      todo.push_back(table.cell(entry.hash, i));
+  }
+
+  std::sort(entries.begin(), entries.end(), lessEntry);
+
+  for (size_t i = 0; i < table.cells.size(); ++i)
+  {
+    IbltCell const & c = table.cells[i];
+    if (c.count != 0 || c.low != 0 || c.high != 0 || c.check != 0)
+      return false;
+  }
+  return true;
+}
+
+bool Iblt::write(const char * fileName, HashFunction function) const
+{
+  FILE * file = fopen(fileName, "wb");
+  if (file == NULL)
+  {
+    std::cerr << "ERROR: Could not open the file: " << fileName << " for writing.\n";
+    return false;
+  }
+
+  IbltHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, BAMHASH_IBLT_MAGIC, sizeof(header.magic));
+  header.function = function;
+  header.cells = cells.size();
+  fwrite(&header, sizeof(header), 1, file);
+  fwrite(cells.data(), sizeof(IbltCell), cells.size(), file);
+
+  if (ferror(file) || fclose(file) != 0)
+  {
+    std::cerr << "ERROR: Could not write to " << fileName << "\n";
+    return false;
+  }
+  return true;
+}
+
+bool Iblt::read(const char * fileName, HashFunction & function)
+{
+  FILE * file = fopen(fileName, "rb");
+  if (file == NULL)
+  {
+    std::cerr << "ERROR: Could not open the file: " << fileName << " for reading.\n";
+    return false;
+  }
+
+  IbltHeader header;
+  bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+            memcmp(header.magic, BAMHASH_IBLT_MAGIC, sizeof(header.magic)) == 0 &&
+            header.cells % BAMHASH_IBLT_HASHES == 0;
+  if (ok)
+  {
+    cells.resize(header.cells);
+    ok = cells.empty() || fread(cells.data(), sizeof(IbltCell), cells.size(), file) == cells.size();
+  }
+  fclose(file);
+
+  if (!ok)
+  {
+    std::cerr << "ERROR: " << fileName << " is not a table written with --iblt\n";
+    return false;
+  }
+  function = (HashFunction)header.function;
+  return true;
+}
+
+bool isIbltFile(const char * fileName) {
+  FILE * file = fopen(fileName, "rb");
+  if (file == NULL) {
+    return false;
+  }
+  char magic[8];
+  bool iblt = fread(magic, sizeof(magic), 1, file) == 1 && memcmp(magic, BAMHASH_IBLT_MAGIC, sizeof(magic)) == 0;
+  fclose(file);
+  return iblt;
+}
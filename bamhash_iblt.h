@@ -0,0 +1,107 @@
+#ifndef BAMHASH_IBLT_H
+#define BAMHASH_IBLT_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "bamhash_checksum_common.h"
+
+// Cells of --iblt-cells by default, about 96KB per hashing thread. The table
+// recovers up to roughly two thirds as many differing reads.
+#define BAMHASH_IBLT_CELLS 3000
+
+// Cells a read is added to, one in each third of the table.
+#define BAMHASH_IBLT_HASHES 3
+
+// A hash that is 2^n times, or an odd multiple of that, more in one table
+// than in the other is recovered for n up to this.
+#define BAMHASH_IBLT_MAX_TWOS 4
+
+#define BAMHASH_IBLT_MAGIC "BHIBLT1"
+
+// -----------------------------------------------------------------------------
+// STRUCT IbltCell
+// -----------------------------------------------------------------------------
+
+// The sums of the reads that fall into a cell, all mod 2^64 and little endian
+// on disk. A file written with --iblt is an IbltHeader followed by the cells.
+
+struct IbltHeader {
+  char magic[8];     // BAMHASH_IBLT_MAGIC
+  uint32_t function; // the HashFunction of the reads
+  uint32_t cells;
+};
+
+struct IbltCell {
+  int64_t count;
+  uint64_t low;   // sum of the hashes
+  uint64_t high;
+  uint64_t check; // sum of ibltCheck() of the hashes
+};
+
+// A hash that is in one table more often than in the other, see Iblt::decode().
+struct IbltEntry {
+  hash_t hash;
+  int64_t count; // > 0 when in the first table
+};
+
+// -----------------------------------------------------------------------------
+// CLASS Iblt
+// -----------------------------------------------------------------------------
+
+// An invertible Bloom lookup table of the hashes of the reads. Every read is
+// added to BAMHASH_IBLT_HASHES cells picked by its hash. Like Counts the cells
+// only hold sums, so tables of several threads are simply added up. Once the
+// table of one set of reads is subtracted from that of another, only the reads
+// that differ are left, and as long as there are not too many they can be
+// peeled off one by one from the cells that hold a single hash. No table with
+// 0 cells.
+
+class Iblt
+{
+  public:
+  // Rounds cells up to a multiple of BAMHASH_IBLT_HASHES.
+  Iblt(unsigned cells = 0);
+
+  bool empty() const
+  {
+    return cells.empty();
+  }
+
+  size_t size() const
+  {
+    return cells.size();
+  }
+
+  void add(hash_t hash);
+
+  // Adds the hashes of a batch that has been hashed.
+  void add(HashBatch const & batch);
+
+  // Adds or subtracts a table of the same size.
+  void add(Iblt const & other, int sign = 1);
+
+  // Peels the hashes off a table that other has been subtracted from, sorted
+  // by hash like the output of bamhash_diff. Returns false if not all could
+  // be recovered, the table then holds too many differences.
+  bool decode(std::vector<IbltEntry> & entries) const;
+
+  // Writes the table. Returns false on an error, after printing it.
+  bool write(const char * fileName, HashFunction function) const;
+
+  // Reads a table written by write(). Returns false on an error, after
+  // printing it.
+  bool read(const char * fileName, HashFunction & function);
+
+  private:
+  void add(hash_t hash, int64_t count);
+  size_t cell(hash_t hash, unsigned i) const;
+  bool pure(size_t at, IbltEntry & entry) const;
+
+  std::vector<IbltCell> cells;
+};
+
+// Whether the file starts like a file written by Iblt::write().
+bool isIbltFile(const char * fileName);
+
+#endif // BAMHASH_IBLT_H
@@ -0,0 +1,132 @@
+#include <string.h>
+#include <stdint.h>
+
+#include "bamhash_checksum_common.h"
+#include "bamhash_md5.h"
+
+// Batches smaller than this are cheaper to hash one message at a time.
+#define BAMHASH_MD5_MIN_BATCH 4
+
+typedef void (*md5Compress_t)(uint32_t *state, const uint32_t *block);
+
+// Copies block number `index` of the MD5 padded form of `msg` into `out`.
+static void md5PaddedBlock(const char *msg, size_t length, size_t index, unsigned char out[64]) {
+  size_t start = index * 64;
+
+  if (start + 64 <= length) {
+    memcpy(out, msg + start, 64);
+    return;
+  }
+
+  memset(out, 0, 64);
+  if (start < length) {
+    memcpy(out, msg + start, length - start);
+  }
+  if (start <= length) {
+    out[length - start] = 0x80;
+  }
+  if (index == (length + 8) / 64) {
+    uint64_t bits = (uint64_t)length << 3;
+    for (int i = 0; i < 8; ++i) {
+      out[56 + i] = (unsigned char)(bits >> (8 * i));
+    }
+  }
+}
+
+// Runs n messages through a `lanes` wide kernel.  Every lane hashes one message
+// at a time and picks up the next unhashed message as soon as it is done, so
+// messages of different lengths keep all lanes busy until the batch runs dry.
+template <int lanes>
+static void md5Lanes(const char * const *strs, const int *lengths, hash_t *out, size_t n,
+                     md5Compress_t compress) {
+  uint32_t state[4 * lanes] __attribute__((aligned(64)));
+  uint32_t block[16 * lanes] __attribute__((aligned(64)));
+  size_t message[lanes];
+  size_t blockIndex[lanes] = {};
+  size_t blockCount[lanes] = {};
+  size_t next = 0;
+  int active = 0;
+
+  memset(block, 0, sizeof(block));
+
+  for (int lane = 0; lane < lanes; ++lane) {
+    message[lane] = n;
+  }
+
+  for (;;) {
+    // Start new messages on the free lanes.
+    for (int lane = 0; lane < lanes; ++lane) {
+      if (message[lane] == n && next < n) {
+        message[lane] = next++;
+        blockIndex[lane] = 0;
+        blockCount[lane] = ((size_t)lengths[message[lane]] + 8) / 64 + 1;
+        state[0 * lanes + lane] = 0x67452301;
+        state[1 * lanes + lane] = 0xefcdab89;
+        state[2 * lanes + lane] = 0x98badcfe;
+        state[3 * lanes + lane] = 0x10325476;
+        ++active;
+      }
+    }
+
+    if (active == 0) {
+      break;
+    }
+
+    // Transpose the current block of every busy lane into the kernel's layout.
+    for (int lane = 0; lane < lanes; ++lane) {
+      if (message[lane] == n) {
+        continue;
+      }
+      uint32_t words[16];
+      md5PaddedBlock(strs[message[lane]], lengths[message[lane]], blockIndex[lane], (unsigned char *)words);
+      for (int i = 0; i < 16; ++i) {
+        block[i * lanes + lane] = words[i];
+      }
+    }
+
+    compress(state, block);
+
+    for (int lane = 0; lane < lanes; ++lane) {
+      if (message[lane] == n || ++blockIndex[lane] < blockCount[lane]) {
+        continue;
+      }
+      uint32_t digest[4];
+      for (int i = 0; i < 4; ++i) {
+        digest[i] = state[i * lanes + lane];
+      }
+      memcpy(out[message[lane]].c, digest, 16);
+      message[lane] = n;
+      --active;
+    }
+  }
+}
+
+const char * md5BatchEngine() {
+  if (md5Avx512Supported()) {
+    return "avx512";
+  }
+  if (md5Avx2Supported()) {
+    return "avx2";
+  }
+  return "scalar";
+}
+
+void str2md5Batch(const char * const *strs, const int *lengths, hash_t *out, size_t n) {
+  static const bool avx512 = md5Avx512Supported();
+  static const bool avx2 = md5Avx2Supported();
+
+  if (n >= BAMHASH_MD5_MIN_BATCH) {
+    if (avx512) {
+      md5Lanes<BAMHASH_MD5_AVX512_LANES>(strs, lengths, out, n, md5CompressAvx512);
+      return;
+    }
+    if (avx2) {
+      md5Lanes<BAMHASH_MD5_AVX2_LANES>(strs, lengths, out, n, md5CompressAvx2);
+      return;
+    }
+  }
+
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = str2md5(strs[i], lengths[i]);
+  }
+}
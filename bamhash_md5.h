@@ -0,0 +1,156 @@
+#ifndef BAMHASH_MD5_H
+#define BAMHASH_MD5_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Multi-buffer MD5: the compression function is run on 8 (AVX2) or 16 (AVX-512)
+// independent messages at once, one message per 32-bit vector lane.
+//
+// Both arguments are laid out lane-major: state[i * lanes + lane] holds word i
+// (A, B, C, D) of the lane's state and block[i * lanes + lane] holds message
+// word i of the lane's current 64 byte block.
+
+#define BAMHASH_MD5_AVX2_LANES 8
+#define BAMHASH_MD5_AVX512_LANES 16
+
+// True when the kernel was compiled in and the running CPU supports it.
+bool md5Avx2Supported();
+bool md5Avx512Supported();
+
+void md5CompressAvx2(uint32_t *state, const uint32_t *block);
+void md5CompressAvx512(uint32_t *state, const uint32_t *block);
+
+// Name of the kernel str2md5Batch dispatches to on this CPU ("avx512", "avx2" or "scalar").
+const char * md5BatchEngine();
+
+
+// -----------------------------------------------------------------------------
+// The MD5 rounds, written once over a vector type V.  V provides Type, LANES,
+// load, store, set1, add, and, or, xor, andnot and rotl<S>.  Only the ISA
+// specific translation units include the definition below.
+// -----------------------------------------------------------------------------
+
+#ifdef BAMHASH_MD5_ROUNDS
+
+template <typename V, int S>
+inline void md5StepF(typename V::Type & a, typename V::Type b, typename V::Type c, typename V::Type d,
+                     typename V::Type x, uint32_t k) {
+  typename V::Type f = V::xor_(d, V::and_(b, V::xor_(c, d)));
+  a = V::add(b, V::template rotl<S>(V::add(V::add(a, f), V::add(x, V::set1(k)))));
+}
+
+template <typename V, int S>
+inline void md5StepG(typename V::Type & a, typename V::Type b, typename V::Type c, typename V::Type d,
+                     typename V::Type x, uint32_t k) {
+  typename V::Type g = V::xor_(c, V::and_(d, V::xor_(b, c)));
+  a = V::add(b, V::template rotl<S>(V::add(V::add(a, g), V::add(x, V::set1(k)))));
+}
+
+template <typename V, int S>
+inline void md5StepH(typename V::Type & a, typename V::Type b, typename V::Type c, typename V::Type d,
+                     typename V::Type x, uint32_t k) {
+  typename V::Type h = V::xor_(V::xor_(b, c), d);
+  a = V::add(b, V::template rotl<S>(V::add(V::add(a, h), V::add(x, V::set1(k)))));
+}
+
+template <typename V, int S>
+inline void md5StepI(typename V::Type & a, typename V::Type b, typename V::Type c, typename V::Type d,
+                     typename V::Type x, uint32_t k) {
+  // c ^ (b | ~d)
+  typename V::Type i = V::xor_(c, V::or_(b, V::andnot(d, V::set1(0xffffffff))));
+  a = V::add(b, V::template rotl<S>(V::add(V::add(a, i), V::add(x, V::set1(k)))));
+}
+
+template <typename V>
+inline void md5Rounds(uint32_t *state, const uint32_t *block) {
+  typedef typename V::Type T;
+
+  T x[16];
+  for (int i = 0; i < 16; ++i) {
+    x[i] = V::load(block + i * V::LANES);
+  }
+
+  T a = V::load(state + 0 * V::LANES);
+  T b = V::load(state + 1 * V::LANES);
+  T c = V::load(state + 2 * V::LANES);
+  T d = V::load(state + 3 * V::LANES);
+  T a0 = a, b0 = b, c0 = c, d0 = d;
+
+  md5StepF<V,  7>(a, b, c, d, x[ 0], 0xd76aa478);
+  md5StepF<V, 12>(d, a, b, c, x[ 1], 0xe8c7b756);
+  md5StepF<V, 17>(c, d, a, b, x[ 2], 0x242070db);
+  md5StepF<V, 22>(b, c, d, a, x[ 3], 0xc1bdceee);
+  md5StepF<V,  7>(a, b, c, d, x[ 4], 0xf57c0faf);
+  md5StepF<V, 12>(d, a, b, c, x[ 5], 0x4787c62a);
+  md5StepF<V, 17>(c, d, a, b, x[ 6], 0xa8304613);
+  md5StepF<V, 22>(b, c, d, a, x[ 7], 0xfd469501);
+  md5StepF<V,  7>(a, b, c, d, x[ 8], 0x698098d8);
+  md5StepF<V, 12>(d, a, b, c, x[ 9], 0x8b44f7af);
+  md5StepF<V, 17>(c, d, a, b, x[10], 0xffff5bb1);
+  md5StepF<V, 22>(b, c, d, a, x[11], 0x895cd7be);
+  md5StepF<V,  7>(a, b, c, d, x[12], 0x6b901122);
+  md5StepF<V, 12>(d, a, b, c, x[13], 0xfd987193);
+  md5StepF<V, 17>(c, d, a, b, x[14], 0xa679438e);
+  md5StepF<V, 22>(b, c, d, a, x[15], 0x49b40821);
+
+  md5StepG<V,  5>(a, b, c, d, x[ 1], 0xf61e2562);
+  md5StepG<V,  9>(d, a, b, c, x[ 6], 0xc040b340);
+  md5StepG<V, 14>(c, d, a, b, x[11], 0x265e5a51);
+  md5StepG<V, 20>(b, c, d, a, x[ 0], 0xe9b6c7aa);
+  md5StepG<V,  5>(a, b, c, d, x[ 5], 0xd62f105d);
+  md5StepG<V,  9>(d, a, b, c, x[10], 0x02441453);
+  md5StepG<V, 14>(c, d, a, b, x[15], 0xd8a1e681);
+  md5StepG<V, 20>(b, c, d, a, x[ 4], 0xe7d3fbc8);
+  md5StepG<V,  5>(a, b, c, d, x[ 9], 0x21e1cde6);
+  md5StepG<V,  9>(d, a, b, c, x[14], 0xc33707d6);
+  md5StepG<V, 14>(c, d, a, b, x[ 3], 0xf4d50d87);
+  md5StepG<V, 20>(b, c, d, a, x[ 8], 0x455a14ed);
+  md5StepG<V,  5>(a, b, c, d, x[13], 0xa9e3e905);
+  md5StepG<V,  9>(d, a, b, c, x[ 2], 0xfcefa3f8);
+  md5StepG<V, 14>(c, d, a, b, x[ 7], 0x676f02d9);
+  md5StepG<V, 20>(b, c, d, a, x[12], 0x8d2a4c8a);
+
+  md5StepH<V,  4>(a, b, c, d, x[ 5], 0xfffa3942);
+  md5StepH<V, 11>(d, a, b, c, x[ 8], 0x8771f681);
+  md5StepH<V, 16>(c, d, a, b, x[11], 0x6d9d6122);
+  md5StepH<V, 23>(b, c, d, a, x[14], 0xfde5380c);
+  md5StepH<V,  4>(a, b, c, d, x[ 1], 0xa4beea44);
+  md5StepH<V, 11>(d, a, b, c, x[ 4], 0x4bdecfa9);
+  md5StepH<V, 16>(c, d, a, b, x[ 7], 0xf6bb4b60);
+  md5StepH<V, 23>(b, c, d, a, x[10], 0xbebfbc70);
+  md5StepH<V,  4>(a, b, c, d, x[13], 0x289b7ec6);
+  md5StepH<V, 11>(d, a, b, c, x[ 0], 0xeaa127fa);
+  md5StepH<V, 16>(c, d, a, b, x[ 3], 0xd4ef3085);
+  md5StepH<V, 23>(b, c, d, a, x[ 6], 0x04881d05);
+  md5StepH<V,  4>(a, b, c, d, x[ 9], 0xd9d4d039);
+  md5StepH<V, 11>(d, a, b, c, x[12], 0xe6db99e5);
+  md5StepH<V, 16>(c, d, a, b, x[15], 0x1fa27cf8);
+  md5StepH<V, 23>(b, c, d, a, x[ 2], 0xc4ac5665);
+
+  md5StepI<V,  6>(a, b, c, d, x[ 0], 0xf4292244);
+  md5StepI<V, 10>(d, a, b, c, x[ 7], 0x432aff97);
+  md5StepI<V, 15>(c, d, a, b, x[14], 0xab9423a7);
+  md5StepI<V, 21>(b, c, d, a, x[ 5], 0xfc93a039);
+  md5StepI<V,  6>(a, b, c, d, x[12], 0x655b59c3);
+  md5StepI<V, 10>(d, a, b, c, x[ 3], 0x8f0ccc92);
+  md5StepI<V, 15>(c, d, a, b, x[10], 0xffeff47d);
+  md5StepI<V, 21>(b, c, d, a, x[ 1], 0x85845dd1);
+  md5StepI<V,  6>(a, b, c, d, x[ 8], 0x6fa87e4f);
+  md5StepI<V, 10>(d, a, b, c, x[15], 0xfe2ce6e0);
+  md5StepI<V, 15>(c, d, a, b, x[ 6], 0xa3014314);
+  md5StepI<V, 21>(b, c, d, a, x[13], 0x4e0811a1);
+  md5StepI<V,  6>(a, b, c, d, x[ 4], 0xf7537e82);
+  md5StepI<V, 10>(d, a, b, c, x[11], 0xbd3af235);
+  md5StepI<V, 15>(c, d, a, b, x[ 2], 0x2ad7d2bb);
+  md5StepI<V, 21>(b, c, d, a, x[ 9], 0xeb86d391);
+
+  V::store(state + 0 * V::LANES, V::add(a, a0));
+  V::store(state + 1 * V::LANES, V::add(b, b0));
+  V::store(state + 2 * V::LANES, V::add(c, c0));
+  V::store(state + 3 * V::LANES, V::add(d, d0));
+}
+
+#endif // BAMHASH_MD5_ROUNDS
+
+#endif // BAMHASH_MD5_H
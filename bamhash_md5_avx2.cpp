@@ -0,0 +1,46 @@
+// AVX2 kernel of the multi-buffer MD5, 8 messages per call.
+// This file is compiled with -mavx2; md5Avx2Supported() gates its use at runtime.
+
+#define BAMHASH_MD5_ROUNDS
+#include "bamhash_md5.h"
+
+#ifdef __AVX2__
+
+#include <immintrin.h>
+
+struct Avx2Vector {
+  typedef __m256i Type;
+  static const int LANES = BAMHASH_MD5_AVX2_LANES;
+
+  static Type load(const uint32_t *p) { return _mm256_load_si256((const __m256i *)p); }
+  static void store(uint32_t *p, Type x) { _mm256_store_si256((__m256i *)p, x); }
+  static Type set1(uint32_t k) { return _mm256_set1_epi32((int)k); }
+  static Type add(Type a, Type b) { return _mm256_add_epi32(a, b); }
+  static Type and_(Type a, Type b) { return _mm256_and_si256(a, b); }
+  static Type or_(Type a, Type b) { return _mm256_or_si256(a, b); }
+  static Type xor_(Type a, Type b) { return _mm256_xor_si256(a, b); }
+  static Type andnot(Type a, Type b) { return _mm256_andnot_si256(a, b); }
+
+  template <int S>
+  static Type rotl(Type x) { return _mm256_or_si256(_mm256_slli_epi32(x, S), _mm256_srli_epi32(x, 32 - S)); }
+};
+
+bool md5Avx2Supported() {
+  return __builtin_cpu_supports("avx2");
+}
+
+void md5CompressAvx2(uint32_t *state, const uint32_t *block) {
+  md5Rounds<Avx2Vector>(state, block);
+}
+
+#else
+
+// Built without -mavx2: the kernel is never selected.
+bool md5Avx2Supported() {
+  return false;
+}
+
+void md5CompressAvx2(uint32_t *, const uint32_t *) {
+}
+
+#endif
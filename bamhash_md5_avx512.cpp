@@ -0,0 +1,46 @@
+// AVX-512 kernel of the multi-buffer MD5, 16 messages per call.
+// This file is compiled with -mavx512f; md5Avx512Supported() gates its use at runtime.
+
+#define BAMHASH_MD5_ROUNDS
+#include "bamhash_md5.h"
+
+#ifdef __AVX512F__
+
+#include <immintrin.h>
+
+struct Avx512Vector {
+  typedef __m512i Type;
+  static const int LANES = BAMHASH_MD5_AVX512_LANES;
+
+  static Type load(const uint32_t *p) { return _mm512_load_si512((const void *)p); }
+  static void store(uint32_t *p, Type x) { _mm512_store_si512((void *)p, x); }
+  static Type set1(uint32_t k) { return _mm512_set1_epi32((int)k); }
+  static Type add(Type a, Type b) { return _mm512_add_epi32(a, b); }
+  static Type and_(Type a, Type b) { return _mm512_and_si512(a, b); }
+  static Type or_(Type a, Type b) { return _mm512_or_si512(a, b); }
+  static Type xor_(Type a, Type b) { return _mm512_xor_si512(a, b); }
+  static Type andnot(Type a, Type b) { return _mm512_andnot_si512(a, b); }
+
+  template <int S>
+  static Type rotl(Type x) { return _mm512_rol_epi32(x, S); }
+};
+
+bool md5Avx512Supported() {
+  return __builtin_cpu_supports("avx512f");
+}
+
+void md5CompressAvx512(uint32_t *state, const uint32_t *block) {
+  md5Rounds<Avx512Vector>(state, block);
+}
+
+#else
+
+// Built without -mavx512f: the kernel is never selected.
+bool md5Avx512Supported() {
+  return false;
+}
+
+void md5CompressAvx512(uint32_t *, const uint32_t *) {
+}
+
+#endif
@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <iostream>
+#include <sys/stat.h>
+
+#include "bamhash_pipeline.h"
+
+// Batches in flight per worker, so the reader rarely waits for a free one.
+#define BAMHASH_BATCHES_PER_THREAD 4
+
+void HashPipeline::HashThread::operator()()
+{
+  seqan::ScopedReadLock<TJobQueue> readLock(pipeline->todoQueue);
+  seqan::ScopedWriteLock<TJobQueue> writeLock(pipeline->idleQueue);
+
+  int batchId = -1;
+
+  // returns false once the reader is done and the queue is drained
+  while (popFront(batchId, pipeline->todoQueue))
+  {
+    HashBatch & batch = pipeline->batches[batchId];
+    batch.hash(pipeline->function);
+    if (pipeline->dump != NULL)
+      pipeline->dump->write(batch);
+    batch.sum(counts, &buckets);
+    iblt.add(batch);
+    batch.clear();
+    appendValue(pipeline->idleQueue, batchId);
+  }
+}
+
+HashPipeline::HashPipeline(unsigned numThreads_, bool debug_, HashFunction function_, HashDump * dump_,
+                           unsigned bucketBits, unsigned ibltCells) :
+  numThreads(debug_ ? 0 : numThreads_),
+  debug(debug_),
+  mate2Separator(" "),
+  function(function_),
+  dump(dump_),
+  finished(false),
+  batches(numThreads == 0 ? 1 : numThreads * BAMHASH_BATCHES_PER_THREAD + 1),
+  currentBatch(0),
+  inlineBuckets(bucketBits),
+  buckets(bucketBits),
+  inlineIblt(ibltCells),
+  iblt(ibltCells),
+  todoQueue(batches.size()),
+  idleQueue(batches.size()),
+  threads(NULL)
+{
+  if (numThreads == 0)
+    return;
+
+  lockWriting(todoQueue);
+  lockReading(idleQueue);
+  setReaderWriterCount(todoQueue, numThreads, 1);
+  setReaderWriterCount(idleQueue, 1, numThreads);
+
+  for (int i = 1; i < (int)batches.size(); ++i)
+    appendValue(idleQueue, i);
+
+  threads = new seqan::Thread<HashThread>[numThreads];
+  for (unsigned i = 0; i < numThreads; ++i)
+  {
+    threads[i].worker.pipeline = this;
+    threads[i].worker.buckets = BucketSums(bucketBits);
+    threads[i].worker.iblt = Iblt(ibltCells);
+    run(threads[i]);
+  }
+}
+
+HashPipeline::~HashPipeline()
+{
+  if (!finished)
+  {
+    std::vector<Counts> ignored;
+    finish(ignored);
+  }
+}
+
+void HashPipeline::hashInline(HashBatch & batch)
+{
+  batch.hash(function);
+  if (dump != NULL)
+    dump->write(batch);
+
+  if (debug)
+  {
+    for (size_t i = 0; i < batch.size; ++i)
+    {
+      TextView str = batch.read(i);
+      std::cout.write(str.data, str.size) << (batch.mates[i] == 2 ? mate2Separator : " ") << std::hex << batch.hashes[i].p.low << "\n";
+    }
+  }
+  else
+  {
+    batch.sum(inlineCounts, &inlineBuckets);
+    inlineIblt.add(batch);
+  }
+
+  batch.clear();
+}
+
+void HashPipeline::submit()
+{
+  if (numThreads == 0)
+  {
+    hashInline(batches[currentBatch]);
+    return;
+  }
+
+  appendValue(todoQueue, currentBatch);
+  popFront(currentBatch, idleQueue);
+}
+
+void HashPipeline::finish(std::vector<Counts> & counts)
+{
+  if (batches[currentBatch].size > 0)
+    submit();
+
+  if (numThreads > 0)
+  {
+    // let the workers drain the queue and stop
+    unlockWriting(todoQueue);
+    for (unsigned i = 0; i < numThreads; ++i)
+      waitFor(threads[i]);
+    unlockReading(idleQueue);
+  }
+
+  std::vector<std::vector<Counts> const *> partial(1, &inlineCounts);
+  for (unsigned i = 0; i < numThreads; ++i)
+    partial.push_back(&threads[i].worker.counts);
+
+  for (size_t i = 0; i < partial.size(); ++i)
+  {
+    if (partial[i]->size() > counts.size())
+      counts.resize(partial[i]->size());
+
+    for (size_t l = 0; l < partial[i]->size(); ++l)
+      counts[l].add((*partial[i])[l]);
+  }
+
+  buckets.add(inlineBuckets);
+  for (unsigned i = 0; i < numThreads; ++i)
+    buckets.add(threads[i].worker.buckets);
+  iblt.add(inlineIblt);
+  for (unsigned i = 0; i < numThreads; ++i)
+    iblt.add(threads[i].worker.iblt);
+
+  delete[] threads;
+  threads = NULL;
+  finished = true;
+}
+
+// Orders jobs by decreasing size, for std::stable_sort().
+struct LargerJob
+{
+  std::vector<uint64_t> const & sizes;
+
+  LargerJob(std::vector<uint64_t> const & sizes_) : sizes(sizes_) {}
+
+  bool operator()(unsigned a, unsigned b) const
+  {
+    return sizes[a] > sizes[b];
+  }
+};
+
+WorkQueue::WorkQueue(std::vector<uint64_t> const & sizes) :
+  order(sizes.size()),
+  nextJob(0),
+  lock(false)
+{
+  for (unsigned i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(), LargerJob(sizes));
+}
+
+bool WorkQueue::next(unsigned & job)
+{
+  seqan::ScopedLock<seqan::Mutex> scopedLock(lock);
+  if (nextJob == order.size())
+    return false;
+  job = order[nextJob++];
+  return true;
+}
+
+void WorkQueue::stop()
+{
+  seqan::ScopedLock<seqan::Mutex> scopedLock(lock);
+  nextJob = order.size();
+}
+
+uint64_t fileSize(const char * fileName)
+{
+  struct stat info;
+  if (stat(fileName, &info) != 0)
+    return 0;
+  return info.st_size;
+}
@@ -0,0 +1,212 @@
+#ifndef BAMHASH_PIPELINE_H
+#define BAMHASH_PIPELINE_H
+
+#include <vector>
+
+#include <seqan/basic.h>
+#include <seqan/parallel.h>
+#include <seqan/system.h>
+
+#include "bamhash_checksum_common.h"
+#include "bamhash_dump.h"
+#include "bamhash_iblt.h"
+
+// -----------------------------------------------------------------------------
+// CLASS HashPipeline
+// -----------------------------------------------------------------------------
+
+// Hashes batches of reads on a pool of worker threads while the caller keeps
+// reading. The reader fills batch() and hands it over with submit(); every
+// worker sums into its own per read group Counts, which finish() merges. The
+// sum is order independent, so the result does not depend on the scheduling.
+//
+// With no worker threads, or in debug mode, batches are hashed on the calling
+// thread. Debug mode prints every string with its hash instead of summing.
+// Every read is hashed with the same HashFunction. The hashes are also written
+// to dump, if there is one, summed in 2^bucketBits buckets, if that is not 0,
+// and added to an Iblt of ibltCells cells, if that is not 0.
+
+class HashPipeline
+{
+  public:
+  typedef seqan::ConcurrentQueue<int, seqan::Suspendable<seqan::Limit> > TJobQueue;
+
+  struct HashThread
+  {
+    HashPipeline * pipeline;
+    std::vector<Counts> counts;
+    BucketSums buckets;
+    Iblt iblt;
+
+    void operator()();
+  };
+
+  HashPipeline(unsigned numThreads, bool debug = false, HashFunction function = HASH_MD5, HashDump * dump = NULL,
+               unsigned bucketBits = 0, unsigned ibltCells = 0);
+  ~HashPipeline();
+
+  // The batch to add the next reads to.
+  HashBatch & batch()
+  {
+    return batches[currentBatch];
+  }
+
+  // The function the reads are hashed with, also for a HashStream.
+  HashFunction hashFunction() const
+  {
+    return function;
+  }
+
+  // True if a read whose hashed string is about length bytes long is better
+  // hashed with a HashStream while it is read, see BAMHASH_STREAM_BYTES. Never in
+  // debug mode, which prints the strings.
+  bool streams(size_t length) const
+  {
+    return !debug && length >= BAMHASH_STREAM_BYTES;
+  }
+
+  // What debug mode prints between the string and the hash of a read of mate
+  // 2, " " like for all other reads unless set.
+  void setMate2Separator(const char * separator)
+  {
+    mate2Separator = separator;
+  }
+
+  // Hands the current batch over for hashing and starts an empty one.
+  void submit();
+
+  // Hashes what is left, stops the workers and adds their sums to counts.
+  void finish(std::vector<Counts> & counts);
+
+  // The bucket sums of all reads, after finish().
+  BucketSums const & bucketSums() const
+  {
+    return buckets;
+  }
+
+  // The table of all reads, after finish().
+  Iblt const & readTable() const
+  {
+    return iblt;
+  }
+
+  private:
+  void hashInline(HashBatch & batch);
+
+  unsigned numThreads;
+  bool debug;
+  const char * mate2Separator;
+  HashFunction function;
+  HashDump * dump;
+  bool finished;
+  std::vector<HashBatch> batches;
+  int currentBatch;
+  std::vector<Counts> inlineCounts;
+  BucketSums inlineBuckets;
+  BucketSums buckets;
+  Iblt inlineIblt;
+  Iblt iblt;
+  TJobQueue todoQueue;
+  TJobQueue idleQueue;
+  seqan::Thread<HashThread> * threads;
+};
+
+// -----------------------------------------------------------------------------
+// CLASS WorkQueue
+// -----------------------------------------------------------------------------
+
+// Hands out the jobs 0..n-1 to the threads that ask for one, largest first, so
+// no thread is left with a big file at the end while the others are idle. Jobs
+// of the same size keep their order. Every thread sums into its own Counts;
+// those are added up once all threads are done.
+
+class WorkQueue
+{
+  public:
+  // sizes[i] is the size of job i, such as the bytes of its input files.
+  WorkQueue(std::vector<uint64_t> const & sizes);
+
+  // The next job, false once all of them have been handed out.
+  bool next(unsigned & job);
+
+  // Hands out no more jobs, after an error.
+  void stop();
+
+  private:
+  std::vector<unsigned> order;
+  size_t nextJob;
+  seqan::Mutex lock;
+};
+
+// The size of a file in bytes, 0 if it can't be found (standard input).
+uint64_t fileSize(const char * fileName);
+
+// -----------------------------------------------------------------------------
+// FUNCTION hashJobs()
+// -----------------------------------------------------------------------------
+
+// Runs the jobs 0..n-1, of the given sizes, on numThreads threads, largest
+// first. Every thread hashes on a HashPipeline of its own, without worker
+// threads, and calls hashJob(pipeline, job, count) for the jobs it takes. A
+// job returns false on an error, then no more jobs are started and hashJobs()
+// returns false. The sums of all threads are added to counts, and their
+// counts to count.
+
+template <typename THashJob>
+struct HashJobThread
+{
+  THashJob const * hashJob;
+  WorkQueue * queue;
+  HashFunction function;
+  std::vector<Counts> counts;
+  unsigned count;
+  bool ok;
+
+  void operator()()
+  {
+    HashPipeline pipeline(0, false, function);
+    unsigned job;
+    while (ok && queue->next(job))
+    {
+      ok = (*hashJob)(pipeline, job, count);
+      if (!ok)
+        queue->stop();
+    }
+    pipeline.finish(counts);
+  }
+};
+
+template <typename THashJob>
+bool hashJobs(THashJob const & hashJob, std::vector<uint64_t> const & sizes, unsigned numThreads,
+              HashFunction function, std::vector<Counts> & counts, unsigned & count)
+{
+  WorkQueue queue(sizes);
+  std::vector<seqan::Thread<HashJobThread<THashJob> > > threads(numThreads);
+  for (unsigned i = 0; i < numThreads; ++i)
+  {
+    HashJobThread<THashJob> & worker = threads[i].worker;
+    worker.hashJob = &hashJob;
+    worker.queue = &queue;
+    worker.function = function;
+    worker.count = 0;
+    worker.ok = true;
+    run(threads[i]);
+  }
+
+  bool ok = true;
+  for (unsigned i = 0; i < numThreads; ++i)
+  {
+    waitFor(threads[i]);
+    HashJobThread<THashJob> const & worker = threads[i].worker;
+    ok = ok && worker.ok;
+
+    if (worker.counts.size() > counts.size())
+      counts.resize(worker.counts.size());
+    for (size_t l = 0; l < worker.counts.size(); ++l)
+      counts[l].add(worker.counts[l]);
+    count += worker.count;
+  }
+  return ok;
+}
+
+#endif // BAMHASH_PIPELINE_H
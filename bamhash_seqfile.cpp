@@ -0,0 +1,118 @@
+#include <iostream>
+
+#include "bamhash_seqfile.h"
+
+// -----------------------------------------------------------------------------
+// CLASS InputFile
+// -----------------------------------------------------------------------------
+
+InputFile::InputFile() :
+  bgzfFile(NULL),
+  bgzfBuf(NULL),
+  gzipBuf(NULL),
+  threaded(NULL)
+{}
+
+InputFile::~InputFile()
+{
+  close();
+}
+
+bool InputFile::open(const char * fileName, unsigned numThreads)
+{
+  close();
+
+  if (numThreads == 0 || !isGzipFile(fileName))
+    return seqan::open(plain, fileName);
+
+  if (isBgzfFile(fileName))
+  {
+    bgzfFile = new std::ifstream(fileName, std::ios_base::in | std::ios_base::binary);
+    if (!bgzfFile->is_open())
+    {
+      close();
+      return false;
+    }
+    bgzfBuf = new TBgzfStreambuf(*bgzfFile, numThreads);
+    threaded = new std::istream(bgzfBuf);
+    return true;
+  }
+
+  gzipBuf = new ParallelGzipStreambuf(fileName, numThreads);
+  if (!gzipBuf->isOpen())
+  {
+    close();
+    return seqan::open(plain, fileName);
+  }
+  threaded = new std::istream(gzipBuf);
+  return true;
+}
+
+void InputFile::close()
+{
+  seqan::close(plain);
+  delete threaded;
+  delete bgzfBuf;
+  delete bgzfFile;
+  delete gzipBuf;
+  threaded = NULL;
+  bgzfBuf = NULL;
+  bgzfFile = NULL;
+  gzipBuf = NULL;
+  errorMessage.clear();
+}
+
+std::streamsize InputFile::read(char * data, std::streamsize size)
+{
+  try
+  {
+    return stream().rdbuf()->sgetn(data, size);
+  }
+  catch (std::exception const & e)
+  {
+    errorMessage = e.what();
+    return 0;
+  }
+}
+
+bool InputFile::readError(const char * fileName) const
+{
+  std::string const & message = gzipBuf != NULL && !gzipBuf->error().empty() ? gzipBuf->error() : errorMessage;
+  if (message.empty())
+    return false;
+
+  std::cerr << "ERROR: Could not inflate " << fileName << ": " << message << "\n";
+  return true;
+}
+
+// -----------------------------------------------------------------------------
+// CLASS SeqFile
+// -----------------------------------------------------------------------------
+
+bool SeqFile::open(const char * fileName, unsigned numThreads)
+{
+  close();
+
+  if (numThreads == 0 || !isGzipFile(fileName))
+    return seqan::open(in, fileName);
+
+  if (!input.open(fileName, numThreads))
+    return false;
+
+  try
+  {
+    return seqan::open(in, input.stream());
+  }
+  catch (seqan::Exception const & e)
+  {
+    std::cerr << "ERROR: " << e.what() << "\n";
+    close();
+    return false;
+  }
+}
+
+void SeqFile::close()
+{
+  seqan::close(in);
+  input.close();
+}
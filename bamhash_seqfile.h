@@ -0,0 +1,78 @@
+#ifndef BAMHASH_SEQFILE_H
+#define BAMHASH_SEQFILE_H
+
+#include <fstream>
+#include <istream>
+#include <string>
+
+#include <seqan/seq_io.h>
+
+#include "bamhash_gzip.h"
+
+// -----------------------------------------------------------------------------
+// CLASS InputFile
+// -----------------------------------------------------------------------------
+
+// The uncompressed content of a FASTQ or FASTA file. BGZF files go through
+// seqan's basic_unbgzf_streambuf with the given number of threads, other gzip
+// files through ParallelGzipStreambuf. Without threads, or for input that is
+// not a regular gzip file, a seqan::VirtualStream reads the file as usual.
+
+class InputFile
+{
+  public:
+  InputFile();
+  ~InputFile();
+
+  bool open(const char * fileName, unsigned numThreads);
+  void close();
+
+  std::istream & stream()
+  {
+    return threaded != NULL ? *threaded : static_cast<std::istream &>(plain);
+  }
+
+  // Reads up to size bytes straight from the stream buffer. Returns 0 at the
+  // end of the file, and also when the buffer throws, as seqan's
+  // basic_unbgzf_streambuf does on broken data; readError() then reports it.
+  std::streamsize read(char * data, std::streamsize size);
+
+  // Prints an error and returns true if the gzip data turned out to be broken.
+  bool readError(const char * fileName) const;
+
+  private:
+  typedef seqan::basic_unbgzf_streambuf<char> TBgzfStreambuf;
+
+  seqan::VirtualStream<char, seqan::Input> plain;
+  std::ifstream * bgzfFile;
+  TBgzfStreambuf * bgzfBuf;
+  ParallelGzipStreambuf * gzipBuf;
+  std::istream * threaded;
+  std::string errorMessage; // what the stream buffer threw
+};
+
+// -----------------------------------------------------------------------------
+// CLASS SeqFile
+// -----------------------------------------------------------------------------
+
+// A seqan::SeqFileIn on top of an InputFile. Without threads, or for input
+// that is not a gzip file, seqan opens the file itself.
+
+class SeqFile
+{
+  public:
+  seqan::SeqFileIn in;
+
+  bool open(const char * fileName, unsigned numThreads);
+  void close();
+
+  bool readError(const char * fileName) const
+  {
+    return input.readError(fileName);
+  }
+
+  private:
+  InputFile input;
+};
+
+#endif // BAMHASH_SEQFILE_H
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "bamhash_split.h"
+
+// A BGZF block is at most 64 KiB, compressed and uncompressed. Cuts look for
+// a block header in two blocks worth of file, and for a record in the data of
+// the four blocks that follow the cut.
+#define SPLIT_BLOCK_WINDOW (2 * 65536 + 18)
+#define SPLIT_RECORD_WINDOW (4 * 65536)
+
+// A cut is accepted after this many records with sane fields, or fewer when
+// the window or the file ends first.
+#define SPLIT_RECORDS 4
+
+static inline uint32_t u16At(const unsigned char *p) {
+  return p[0] | (uint32_t)p[1] << 8;
+}
+
+static inline int32_t i32At(const unsigned char *p) {
+  int32_t x;
+  memcpy(&x, p, 4);
+  return x;
+}
+
+// The size of the BGZF block whose header starts at p, 0 if it is no header:
+// gzip with the FEXTRA flag and a 6 byte extra field holding the BC subfield.
+static uint32_t blockSize(const unsigned char *p) {
+  if (p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || !(p[3] & 4) || u16At(p + 10) != 6 ||
+      p[12] != 'B' || p[13] != 'C' || u16At(p + 14) != 2) {
+    return 0;
+  }
+  uint32_t size = u16At(p + 16) + 1;
+  // header, an empty deflate stream and the CRC32 and ISIZE footer
+  return size < 18 + 2 + 8 ? 0 : size;
+}
+
+// The offset of the first BGZF block at or after from, or -1. A block header
+// only counts if it is followed by another block header or the end of the file.
+static int64_t nextBlock(FILE *f, int64_t from, int64_t fileSize) {
+  std::vector<unsigned char> buf(SPLIT_BLOCK_WINDOW);
+  if (fseeko(f, from, SEEK_SET) != 0) {
+    return -1;
+  }
+  size_t n = fread(&buf[0], 1, buf.size(), f);
+
+  for (size_t i = 0; i + 18 <= n; ++i) {
+    uint32_t size = blockSize(&buf[i]);
+    if (size == 0) {
+      continue;
+    }
+
+    int64_t next = from + i + size;
+    if (next == fileSize) {
+      return from + i;
+    }
+    if (next + 18 > fileSize) {
+      continue;
+    }
+
+    unsigned char header[18];
+    if (next + 18 <= from + (int64_t)n) {
+      memcpy(header, &buf[next - from], 18);
+    } else if (fseeko(f, next, SEEK_SET) != 0 || fread(header, 1, 18, f) != 18) {
+      return -1;
+    }
+    if (blockSize(header) != 0) {
+      return from + i;
+    }
+  }
+  return -1;
+}
+
+// The block_size of the BAM record starting at p, or -1 if its fixed fields
+// can't belong to a record of this header. p holds at least 36 bytes.
+static int32_t recordSize(const unsigned char *p, bam_hdr_t const *hdr) {
+  int32_t size = i32At(p);
+  int32_t tid = i32At(p + 4);
+  int32_t pos = i32At(p + 8);
+  uint32_t nameLength = i32At(p + 12) & 0xff;
+  uint32_t cigarLength = i32At(p + 16) & 0xffff;
+  int32_t seqLength = i32At(p + 20);
+  int32_t mateTid = i32At(p + 24);
+  int32_t matePos = i32At(p + 28);
+
+  if (tid < -1 || tid >= hdr->n_targets || mateTid < -1 || mateTid >= hdr->n_targets) {
+    return -1;
+  }
+  if (pos < -1 || matePos < -1 || seqLength < 0 || nameLength == 0) {
+    return -1;
+  }
+  if ((tid >= 0 && pos > (int64_t)hdr->target_len[tid]) ||
+      (mateTid >= 0 && matePos > (int64_t)hdr->target_len[mateTid])) {
+    return -1;
+  }
+  int64_t fields = 32 + nameLength + 4 * (int64_t)cigarLength + (seqLength + 1) / 2 + (int64_t)seqLength;
+  return fields > size ? -1 : size;
+}
+
+// A read name is printable and ends in a NUL.
+static bool validName(const unsigned char *name, uint32_t length) {
+  if (name[length - 1] != 0) {
+    return false;
+  }
+  for (uint32_t i = 0; i + 1 < length; ++i) {
+    if (name[i] < '!' || name[i] > '~') {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Whether a run of records starts at offset u of the n bytes in buf. atEnd
+// is set when buf runs up to the end of the file.
+static bool recordsAt(const unsigned char *buf, size_t u, size_t n, bool atEnd, bam_hdr_t const *hdr) {
+  size_t pos = u;
+  for (int records = 0; records < SPLIT_RECORDS; ++records) {
+    if (pos == n && atEnd) {
+      return records > 0;
+    }
+    if (pos + 36 > n) {
+      return records > 0 && !atEnd;
+    }
+
+    int32_t size = recordSize(buf + pos, hdr);
+    if (size < 0) {
+      return false;
+    }
+    if (pos + 4 + size > n) {
+      // the record goes on past the window, its fixed fields have to do
+      return records > 0 && !atEnd;
+    }
+    if (!validName(buf + pos + 36, buf[pos + 12])) {
+      return false;
+    }
+    pos += 4 + size;
+  }
+  return true;
+}
+
+// The virtual offset of the first record that starts in the data from the
+// block at offset block on, or -1.
+static int64_t firstRecord(BGZF *fp, int64_t block, bam_hdr_t const *hdr) {
+  std::vector<unsigned char> buf(SPLIT_RECORD_WINDOW);
+  if (bgzf_seek(fp, block << 16, SEEK_SET) < 0) {
+    return -1;
+  }
+  ssize_t n = bgzf_read(fp, &buf[0], buf.size());
+  if (n <= 0) {
+    return -1;
+  }
+
+  bool atEnd = (size_t)n < buf.size();
+  for (size_t u = 0; u < (size_t)n; ++u) {
+    if (recordsAt(&buf[0], u, n, atEnd, hdr)) {
+      // read up to the record, so BGZF works out its virtual offset
+      if (bgzf_seek(fp, block << 16, SEEK_SET) < 0 || bgzf_read(fp, &buf[0], u) != (ssize_t)u) {
+        return -1;
+      }
+      return bgzf_tell(fp);
+    }
+  }
+  return -1;
+}
+
+std::vector<int64_t> splitBam(BGZF * fp, const char * filename, bam_hdr_t const * hdr, int64_t start,
+                              unsigned numRanges) {
+  std::vector<int64_t> offsets(1, start);
+
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL) {
+    return offsets;
+  }
+  int64_t fileSize = -1;
+  if (fseeko(f, 0, SEEK_END) == 0) {
+    fileSize = ftello(f);
+  }
+
+  for (unsigned i = 1; i < numRanges && fileSize > 0; ++i) {
+    int64_t cut = fileSize * i / numRanges;
+    if (cut <= (start >> 16)) {
+      continue;
+    }
+
+    int64_t block = nextBlock(f, cut, fileSize);
+    if (block < 0) {
+      continue;
+    }
+    int64_t offset = firstRecord(fp, block, hdr);
+    // a cut in a long record can land on the same record as the one before
+    if (offset > offsets.back()) {
+      offsets.push_back(offset);
+    }
+  }
+
+  fclose(f);
+  return offsets;
+}
@@ -0,0 +1,26 @@
+#ifndef BAMHASH_SPLIT_H
+#define BAMHASH_SPLIT_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "htslib/bgzf.h"
+#include "htslib/sam.h"
+
+// Splitting of a BAM file without an index into ranges that can be read on
+// several threads. The file is cut at about even compressed sizes; every cut
+// is moved to the next BGZF block, found by its 18 byte header, and then to
+// the first record that starts in the data of that block.
+//
+// A record boundary is only recognised by its contents: a cut is accepted
+// where a run of records with sane fields follows. Readers of the ranges
+// should check that the range before a cut ends exactly on it.
+
+// The virtual offsets where the ranges start, ascending. The first is start,
+// the virtual offset of the first record (after the header). Reads fp, which
+// has to be positioned on start again before it is used for reading records.
+// Returns just start when the file can't be split.
+std::vector<int64_t> splitBam(BGZF * fp, const char * filename, bam_hdr_t const * hdr, int64_t start,
+                              unsigned numRanges);
+
+#endif // BAMHASH_SPLIT_H
@@ -0,0 +1,341 @@
+#include <string.h>
+#include <stdint.h>
+
+#include "bamhash_xxh3.h"
+
+// See https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md, the
+// function names follow xxhash.h. Like the MD5 kernels this assumes a little
+// endian CPU.
+
+#define PRIME32_1 0x9E3779B1U
+#define PRIME32_2 0x85EBCA77U
+#define PRIME32_3 0xC2B2AE3DU
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+#define PRIME_MX1 0x165667919E3779F9ULL
+#define PRIME_MX2 0x9FB21C651E98DF25ULL
+
+#define SECRET_SIZE 192
+#define STRIPES_PER_BLOCK ((SECRET_SIZE - BAMHASH_XXH3_STRIPE) / 8)
+
+static const unsigned char kSecret[SECRET_SIZE] = {
+  0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+  0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+  0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+  0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+  0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+  0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+  0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+  0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+  0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+  0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+  0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+  0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+struct Hash128 {
+  uint64_t low;
+  uint64_t high;
+};
+
+static inline uint32_t read32(const unsigned char *p) {
+  uint32_t x;
+  memcpy(&x, p, 4);
+  return x;
+}
+
+static inline uint64_t read64(const unsigned char *p) {
+  uint64_t x;
+  memcpy(&x, p, 8);
+  return x;
+}
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint32_t rotl32(uint32_t x, int r) {
+  return (x << r) | (x >> (32 - r));
+}
+
+static inline Hash128 mult64to128(uint64_t a, uint64_t b) {
+  unsigned __int128 product = (unsigned __int128)a * b;
+  Hash128 r = {(uint64_t)product, (uint64_t)(product >> 64)};
+  return r;
+}
+
+static inline uint64_t mul128fold64(uint64_t a, uint64_t b) {
+  Hash128 product = mult64to128(a, b);
+  return product.low ^ product.high;
+}
+
+static inline uint64_t xxh64Avalanche(uint64_t h) {
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+static inline uint64_t xxh3Avalanche(uint64_t h) {
+  h ^= h >> 37;
+  h *= PRIME_MX1;
+  h ^= h >> 32;
+  return h;
+}
+
+static inline uint64_t mix16B(const unsigned char *in, const unsigned char *secret) {
+  return mul128fold64(read64(in) ^ read64(secret), read64(in + 8) ^ read64(secret + 8));
+}
+
+static inline Hash128 mix32B(Hash128 acc, const unsigned char *in1, const unsigned char *in2, const unsigned char *secret) {
+  acc.low += mix16B(in1, secret);
+  acc.low ^= read64(in2) + read64(in2 + 8);
+  acc.high += mix16B(in2, secret + 16);
+  acc.high ^= read64(in1) + read64(in1 + 8);
+  return acc;
+}
+
+// -----------------------------------------------------------------------------
+// Inputs of up to 240 bytes
+// -----------------------------------------------------------------------------
+
+static Hash128 len0(void) {
+  Hash128 h;
+  h.low = xxh64Avalanche(read64(kSecret + 64) ^ read64(kSecret + 72));
+  h.high = xxh64Avalanche(read64(kSecret + 80) ^ read64(kSecret + 88));
+  return h;
+}
+
+static Hash128 len1to3(const unsigned char *in, size_t len) {
+  uint32_t combinedl = ((uint32_t)in[0] << 16) | ((uint32_t)in[len >> 1] << 24) | (uint32_t)in[len - 1] | ((uint32_t)len << 8);
+  uint32_t combinedh = rotl32(__builtin_bswap32(combinedl), 13);
+  uint64_t bitflipl = read32(kSecret) ^ read32(kSecret + 4);
+  uint64_t bitfliph = read32(kSecret + 8) ^ read32(kSecret + 12);
+  Hash128 h;
+  h.low = xxh64Avalanche(combinedl ^ bitflipl);
+  h.high = xxh64Avalanche(combinedh ^ bitfliph);
+  return h;
+}
+
+static Hash128 len4to8(const unsigned char *in, size_t len) {
+  uint64_t input = read32(in) + ((uint64_t)read32(in + len - 4) << 32);
+  uint64_t bitflip = read64(kSecret + 16) ^ read64(kSecret + 24);
+  Hash128 m = mult64to128(input ^ bitflip, PRIME64_1 + (len << 2));
+  m.high += m.low << 1;
+  m.low ^= m.high >> 3;
+  m.low ^= m.low >> 35;
+  m.low *= PRIME_MX2;
+  m.low ^= m.low >> 28;
+  m.high = xxh3Avalanche(m.high);
+  return m;
+}
+
+static Hash128 len9to16(const unsigned char *in, size_t len) {
+  uint64_t bitflipl = read64(kSecret + 32) ^ read64(kSecret + 40);
+  uint64_t bitfliph = read64(kSecret + 48) ^ read64(kSecret + 56);
+  uint64_t inputLow = read64(in);
+  uint64_t inputHigh = read64(in + len - 8);
+  Hash128 m = mult64to128(inputLow ^ inputHigh ^ bitflipl, PRIME64_1);
+  m.low += (uint64_t)(len - 1) << 54;
+  inputHigh ^= bitfliph;
+  m.high += inputHigh + (uint64_t)(uint32_t)inputHigh * (PRIME32_2 - 1);
+  m.low ^= __builtin_bswap64(m.high);
+  Hash128 h = mult64to128(m.low, PRIME64_2);
+  h.high += m.high * PRIME64_2;
+  h.low = xxh3Avalanche(h.low);
+  h.high = xxh3Avalanche(h.high);
+  return h;
+}
+
+static Hash128 finishMid(Hash128 acc, size_t len) {
+  Hash128 h;
+  h.low = xxh3Avalanche(acc.low + acc.high);
+  h.high = 0 - xxh3Avalanche(acc.low * PRIME64_1 + acc.high * PRIME64_4 + len * PRIME64_2);
+  return h;
+}
+
+static Hash128 len17to128(const unsigned char *in, size_t len) {
+  Hash128 acc = {len * PRIME64_1, 0};
+  if (len > 32) {
+    if (len > 64) {
+      if (len > 96) {
+        acc = mix32B(acc, in + 48, in + len - 64, kSecret + 96);
+      }
+      acc = mix32B(acc, in + 32, in + len - 48, kSecret + 64);
+    }
+    acc = mix32B(acc, in + 16, in + len - 32, kSecret + 32);
+  }
+  acc = mix32B(acc, in, in + len - 16, kSecret);
+  return finishMid(acc, len);
+}
+
+static Hash128 len129to240(const unsigned char *in, size_t len) {
+  Hash128 acc = {len * PRIME64_1, 0};
+  size_t i;
+  for (i = 32; i < 160; i += 32) {
+    acc = mix32B(acc, in + i - 32, in + i - 16, kSecret + i - 32);
+  }
+  acc.low = xxh3Avalanche(acc.low);
+  acc.high = xxh3Avalanche(acc.high);
+  for (i = 160; i <= len; i += 32) {
+    acc = mix32B(acc, in + i - 32, in + i - 16, kSecret + 3 + i - 160);
+  }
+  // the last 32 bytes, with the secret 17 bytes from the end of the minimum secret
+  acc = mix32B(acc, in + len - 16, in + len - 32, kSecret + 136 - 17 - 16);
+  return finishMid(acc, len);
+}
+
+static Hash128 hashShort(const unsigned char *in, size_t len) {
+  if (len == 0) {
+    return len0();
+  }
+  if (len <= 3) {
+    return len1to3(in, len);
+  }
+  if (len <= 8) {
+    return len4to8(in, len);
+  }
+  if (len <= 16) {
+    return len9to16(in, len);
+  }
+  if (len <= 128) {
+    return len17to128(in, len);
+  }
+  return len129to240(in, len);
+}
+
+// -----------------------------------------------------------------------------
+// Longer inputs, in blocks of STRIPES_PER_BLOCK stripes of 64 bytes
+// -----------------------------------------------------------------------------
+
+static void initAcc(uint64_t *acc) {
+  acc[0] = PRIME32_3;
+  acc[1] = PRIME64_1;
+  acc[2] = PRIME64_2;
+  acc[3] = PRIME64_3;
+  acc[4] = PRIME64_4;
+  acc[5] = PRIME32_2;
+  acc[6] = PRIME64_5;
+  acc[7] = PRIME32_1;
+}
+
+static inline void accumulate512(uint64_t *acc, const unsigned char *in, const unsigned char *secret) {
+  for (int i = 0; i < 8; ++i) {
+    uint64_t value = read64(in + 8 * i);
+    uint64_t key = value ^ read64(secret + 8 * i);
+    acc[i ^ 1] += value;
+    acc[i] += (uint64_t)(uint32_t)key * (key >> 32);
+  }
+}
+
+static void accumulate(uint64_t *acc, const unsigned char *in, size_t stripes) {
+  for (size_t n = 0; n < stripes; ++n) {
+    accumulate512(acc, in + n * BAMHASH_XXH3_STRIPE, kSecret + n * 8);
+  }
+}
+
+static void scramble(uint64_t *acc) {
+  const unsigned char *secret = kSecret + SECRET_SIZE - BAMHASH_XXH3_STRIPE;
+  for (int i = 0; i < 8; ++i) {
+    uint64_t a = acc[i];
+    a ^= a >> 47;
+    a ^= read64(secret + 8 * i);
+    a *= PRIME32_1;
+    acc[i] = a;
+  }
+}
+
+static uint64_t mergeAccs(const uint64_t *acc, const unsigned char *secret, uint64_t start) {
+  uint64_t result = start;
+  for (int i = 0; i < 4; ++i) {
+    result += mul128fold64(acc[2 * i] ^ read64(secret + 16 * i), acc[2 * i + 1] ^ read64(secret + 16 * i + 8));
+  }
+  return xxh3Avalanche(result);
+}
+
+// Accumulates the last, partial, block: the `rest` bytes at `in`, 1 to
+// BAMHASH_XXH3_BLOCK of them, and then the 64 bytes that end the input, which
+// start at in + rest - 64. Returns the hash of the `len` bytes of input.
+static Hash128 finishLong(uint64_t *acc, const unsigned char *in, size_t rest, uint64_t len) {
+  accumulate(acc, in, (rest - 1) / BAMHASH_XXH3_STRIPE);
+  accumulate512(acc, in + rest - BAMHASH_XXH3_STRIPE, kSecret + SECRET_SIZE - BAMHASH_XXH3_STRIPE - 7);
+
+  Hash128 h;
+  h.low = mergeAccs(acc, kSecret + 11, len * PRIME64_1);
+  h.high = mergeAccs(acc, kSecret + SECRET_SIZE - 64 - 11, ~(len * PRIME64_2));
+  return h;
+}
+
+static void store(Hash128 h, unsigned char *out) {
+  memcpy(out, &h.low, 8);
+  memcpy(out + 8, &h.high, 8);
+}
+
+void xxh3Hash(const char *str, size_t length, unsigned char *out) {
+  const unsigned char *in = (const unsigned char *)str;
+  if (length <= 240) {
+    store(hashShort(in, length), out);
+    return;
+  }
+
+  uint64_t acc[8];
+  initAcc(acc);
+  size_t blocks = (length - 1) / BAMHASH_XXH3_BLOCK;
+  for (size_t n = 0; n < blocks; ++n) {
+    accumulate(acc, in + n * BAMHASH_XXH3_BLOCK, STRIPES_PER_BLOCK);
+    scramble(acc);
+  }
+  size_t done = blocks * BAMHASH_XXH3_BLOCK;
+  store(finishLong(acc, in + done, length - done, length), out);
+}
+
+// -----------------------------------------------------------------------------
+// Streaming: full blocks are accumulated once more input follows them, so the
+// last block is always left for xxh3Final(), as xxh3Hash() does.
+// -----------------------------------------------------------------------------
+
+void xxh3Init(Xxh3State & state) {
+  initAcc(state.acc);
+  state.buffered = 0;
+  state.total = 0;
+}
+
+void xxh3Update(Xxh3State & state, const char *data, size_t length) {
+  unsigned char *pending = state.buffer + BAMHASH_XXH3_STRIPE;
+  state.total += length;
+
+  while (length > 0) {
+    if (state.buffered == BAMHASH_XXH3_BLOCK) {
+      accumulate(state.acc, pending, STRIPES_PER_BLOCK);
+      scramble(state.acc);
+      memcpy(state.buffer, pending + BAMHASH_XXH3_BLOCK - BAMHASH_XXH3_STRIPE, BAMHASH_XXH3_STRIPE);
+      state.buffered = 0;
+    }
+    size_t n = BAMHASH_XXH3_BLOCK - state.buffered;
+    if (n > length) {
+      n = length;
+    }
+    memcpy(pending + state.buffered, data, n);
+    state.buffered += n;
+    data += n;
+    length -= n;
+  }
+}
+
+void xxh3Final(Xxh3State & state, unsigned char *out) {
+  if (state.total <= 240) {
+    store(hashShort(state.buffer + BAMHASH_XXH3_STRIPE, state.buffered), out);
+    return;
+  }
+
+  // buffer[0..64) holds the input before the pending bytes, so the last stripe
+  // is contiguous even if fewer than 64 bytes are pending
+  uint64_t acc[8];
+  memcpy(acc, state.acc, sizeof(acc));
+  store(finishLong(acc, state.buffer + BAMHASH_XXH3_STRIPE, state.buffered, state.total), out);
+}
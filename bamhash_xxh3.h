@@ -0,0 +1,31 @@
+#ifndef BAMHASH_XXH3_H
+#define BAMHASH_XXH3_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// XXH3 with 128 bit output, seed 0 and the default secret, as XXH3_128bits()
+// of xxHash 0.8. Written out here in portable C++ so the build needs no other
+// library. The low half of the result is the first 8 bytes of hash_t.
+
+#define BAMHASH_XXH3_STRIPE 64
+#define BAMHASH_XXH3_BLOCK 1024
+
+struct Xxh3State {
+  uint64_t acc[8];
+  // the last BAMHASH_XXH3_STRIPE bytes of the data before `buffer`, then the
+  // input that is not accumulated yet
+  unsigned char buffer[BAMHASH_XXH3_STRIPE + BAMHASH_XXH3_BLOCK];
+  size_t buffered;
+  uint64_t total;
+};
+
+void xxh3Init(Xxh3State & state);
+void xxh3Update(Xxh3State & state, const char *data, size_t length);
+// Writes the hash, low half first, to out[0..16).
+void xxh3Final(Xxh3State & state, unsigned char *out);
+
+// XXH3-128 of a string, out[0..16) as for xxh3Final().
+void xxh3Hash(const char *str, size_t length, unsigned char *out);
+
+#endif // BAMHASH_XXH3_H
@@ -16,6 +16,7 @@
 #include <htslib/sam.h>
 // #include <htslib/vcf.h>
 #include <htslib/bgzf.h>
+#include <htslib/thread_pool.h>
 
 #include <seqan/hts_io/bam_alignment_record.h>
 #include <seqan/hts_io/hts_alignment_record.h>
@@ -34,6 +35,8 @@ class HtsFile
     hts_idx_t * hts_index;  /** @brief The index of the file. */
     hts_itr_t * hts_iter;   /** @brief An iterator that iterates through a certain region in the HTS file. */
     const char * file_mode; /** @brief Which file mode to use. E.g. "r" for reading and "wb" for writing binaries. */
+    htsThreadPool * thread_pool; /** @brief Shared htslib thread pool used for (de)compression, or nullptr. */
+    int required_fields;    /** @brief SAM_* fields a CRAM file has to decode, 0 for all of them. */
     bool at_end = false;
     bool read_all = true;
 
@@ -41,7 +44,7 @@ class HtsFile
      * @brief Empty HTS file constructor
      */
     HtsFile(const char * mode = "r")
-      : filename(""), fp(nullptr), hdr(nullptr), hts_record(nullptr), hts_index(nullptr), hts_iter(nullptr), file_mode(mode), at_end(false)
+      : filename(""), fp(nullptr), hdr(nullptr), hts_record(nullptr), hts_index(nullptr), hts_iter(nullptr), file_mode(mode), thread_pool(nullptr), required_fields(0), at_end(false)
     {
         // Don't call open() yet, file name is not known
     }
@@ -52,10 +55,14 @@ class HtsFile
      * @param f The filename of the file.
      * @param mode The file mode to use when opening the file.
      * @param reference Reference FASTA file. Used for reading CRAM files.
+     * @param pool Thread pool that BGZF blocks and CRAM containers are (de)compressed on.
+     *             May be shared by many files and must outlive them. nullptr for none.
+     * @param fields SAM_* flags of the fields a CRAM file has to decode (CRAM_OPT_REQUIRED_FIELDS),
+     *               MD and NM are then not generated either. 0 decodes everything.
      * @return A new HtsFile object.
      */
-    HtsFile(const char * f, const char * mode, const char * reference = "")
-      : filename(f), fp(nullptr), hdr(nullptr), hts_record(nullptr), hts_index(nullptr), hts_iter(nullptr), file_mode(mode), at_end(false)
+    HtsFile(const char * f, const char * mode, const char * reference = "", htsThreadPool * pool = nullptr, int fields = 0)
+      : filename(f), fp(nullptr), hdr(nullptr), hts_record(nullptr), hts_index(nullptr), hts_iter(nullptr), file_mode(mode), thread_pool(pool), required_fields(fields), at_end(false)
     {
         open(reference);
     }
@@ -65,6 +72,12 @@ class HtsFile
      */
     ~HtsFile()
     {
+        if (hts_iter)
+            sam_itr_destroy(hts_iter);
+
+        if (hts_index)
+            hts_idx_destroy(hts_index);
+
         if (hdr)
             bam_hdr_destroy(hdr);
 
@@ -98,6 +111,27 @@ class HtsFile
             }
         }
 
+        // Attach the thread pool before the header is read, so all decompression runs on it
+        if (thread_pool != nullptr && thread_pool->pool != nullptr)
+        {
+            int ret = hts_set_thread_pool(fp, thread_pool);
+
+            if (ret < 0)
+            {
+                SEQAN_FAIL("Could not attach thread pool to file with filename %s", filename);
+            }
+        }
+
+        // Let CRAM skip the data series that are not needed
+        if (required_fields != 0 && hts_get_format(fp)->format == cram)
+        {
+            if (hts_set_opt(fp, CRAM_OPT_REQUIRED_FIELDS, required_fields) < 0 ||
+                hts_set_opt(fp, CRAM_OPT_DECODE_MD, 0) < 0)
+            {
+                SEQAN_FAIL("Could not set the required CRAM fields of file with filename %s", filename);
+            }
+        }
+
         if (strcmp(file_mode, read_mode) == 0)
         {
             hdr = sam_hdr_read(fp);
@@ -336,6 +370,23 @@ readRecord(HtsFile & file)
     return false;
 }
 
+/**
+ * @brief Read the next record of the region set with setRegion() into file.hts_record.
+ *
+ * @param file HTS file to read from.
+ * @returns True on success, otherwise false.
+ */
+inline bool
+readRegion(HtsFile & file)
+{
+    if (file.read_all)
+    {
+        return readRecord(file);
+    }
+
+    return sam_itr_next(file.fp, file.hts_iter, file.hts_record) >= 0;
+}
+
 /**
  * @brief Read the next record from a HTS file and parse it to a sequence record.
  *
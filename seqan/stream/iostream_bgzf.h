@@ -479,10 +479,22 @@ public:
 
                 if (!job.ready)
                 {
-                    // decompress block
-                    job.size = _decompressBlock(
-                        &job.buffer[0] + MAX_PUTBACK, capacity(job.buffer),
-                        &job.inputBuffer[0], job.compressedSize, compressionCtx);
+                    // decompress block, a broken one ends the stream with an
+                    // error that underflow() throws in the reading thread
+                    try
+                    {
+                        job.size = _decompressBlock(
+                            &job.buffer[0] + MAX_PUTBACK, capacity(job.buffer),
+                            &job.inputBuffer[0], job.compressedSize, compressionCtx);
+                    }
+                    catch (IOError const & e)
+                    {
+                        ScopedLock<Mutex> scopedLock(streamBuf->serializer.lock);
+                        if (streamBuf->serializer.error == NULL)
+                            streamBuf->serializer.error = new IOError(e);
+                        streamBuf->serializer.fileOfs = -1;
+                        job.size = -1;
+                    }
 
                     // signal that job is ready
                     {
@@ -599,7 +611,12 @@ public:
                   &job.buffer[0] + (MAX_PUTBACK + size));       // end of buffer
 
             if (job.size == -1)
+            {
+                ScopedLock<Mutex> scopedLock(serializer.lock);
+                if (serializer.error != NULL)
+                    throw *serializer.error;
                 return EOF;
+            }
             else if (job.size > 0)
                 return Tr::to_int_type(*this->gptr());      // return next character
         }